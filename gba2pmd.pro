@@ -1,4 +1,4 @@
-QT       += core gui
+QT       += core gui concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -19,19 +19,45 @@ SOURCES += \
     src/aif2pcm/aif2pcm.cpp \
     src/aif2pcm/extended.cpp \
     src/binary_utils.cpp \
+    src/checksum.cpp \
+    src/cli.cpp \
+    src/extraction_worker.cpp \
     src/gba_music_utils.cpp \
     src/globals.cpp \
+    src/m4a_disassembler.cpp \
+    src/m4a_sequence.cpp \
     src/main.cpp \
     src/mainwindow.cpp \
-    src/pret_utils.cpp
+    src/midi_writer.cpp \
+    src/pret_utils.cpp \
+    src/resampler.cpp \
+    src/rom_profiles.cpp \
+    src/sample_cache.cpp \
+    src/sample_similarity.cpp \
+    src/song_renderer.cpp \
+    src/song_table_locator.cpp
 
 HEADERS += \
     include/aif2pcm/aif2pcm.h \
     include/binary_utils.h \
+    include/checksum.h \
+    include/cli.h \
+    include/extraction_worker.h \
     include/gba_music_utils.h \
     include/globals.h \
+    include/m4a_disassembler.h \
+    include/m4a_sequence.h \
     include/mainwindow.h \ \
-    include/pret_utils.h
+    include/midi_writer.h \
+    include/offset_index.h \
+    include/pret_utils.h \
+    include/resampler.h \
+    include/rom_profiles.h \
+    include/rom_view.h \
+    include/sample_cache.h \
+    include/sample_similarity.h \
+    include/song_renderer.h \
+    include/song_table_locator.h
 
 FORMS += \
     gui/mainwindow.ui \
@@ -1,6 +1,17 @@
 #ifndef AIF2PCM_H
 #define AIF2PCM_H
 
-int main_aif2pcm(char *input_file);
+#include <stdint.h>
+
+#define AIF_BASE_NOTE 60
+#define DELTA_BLOCK_SAMPLES 64
+#define DELTA_BLOCK_BYTES 33
+
+void pcm2aif(const char *pcm_filename, const char *aif_filename, uint32_t base_note);
+unsigned long delta_compressed_length(unsigned long num_samples);
+bool pcm2aif_buffer(const uint8_t *pcm_data, unsigned long pcm_length, const char *aif_filename, uint32_t base_note);
+bool pcm2bin_buffer(const uint8_t *pcm_data, unsigned long pcm_length, const char *bin_filename, uint32_t base_note);
+uint8_t *read_sample_data(const uint8_t *pcm_data, unsigned long pcm_length, unsigned long *num_samples);
+bool pcm2wav_buffer(const uint8_t *pcm_data, unsigned long pcm_length, const char *wav_filename, uint32_t base_note);
 
 #endif // AIF2PCM_H
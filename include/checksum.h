@@ -0,0 +1,21 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+
+#include <QtGlobal>
+
+#define CRC32_CHUNK_SIZE 0x100000
+
+struct Hash128 {
+    quint64 low;
+    quint64 high;
+};
+
+inline bool operator==(const Hash128 &a, const Hash128 &b) { return a.low == b.low && a.high == b.high; }
+inline uint qHash(const Hash128 &key, uint seed = 0) { return uint(key.low ^ (key.low >> 32)) ^ seed; }
+
+quint32 Crc32(const uchar *data, quint32 length, quint32 crc = 0);
+quint32 Crc32Combine(quint32 crc1, quint32 crc2, quint32 length2);
+quint32 ParallelCrc32(const uchar *data, quint32 length);
+Hash128 Murmur3Hash128(const uchar *data, quint32 length, quint32 seed = 0);
+
+#endif // CHECKSUM_H
@@ -0,0 +1,9 @@
+#ifndef CLI_H
+#define CLI_H
+
+enum {CLI_EXIT_OK, CLI_EXIT_USAGE, CLI_EXIT_ROM, CLI_EXIT_PRET, CLI_EXIT_EXTRACTION};
+
+bool IsCommandLineInvocation(int argc, char *argv[]);
+int RunCommandLine(int argc, char *argv[]);
+
+#endif // CLI_H
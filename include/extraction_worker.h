@@ -0,0 +1,35 @@
+#ifndef EXTRACTION_WORKER_H
+#define EXTRACTION_WORKER_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+
+#define PROGRESS_INTERVAL_MS 33     //~30 updates per second
+
+//Runs ExtractROMSongData outside the GUI thread
+class ExtractionWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    ExtractionWorker(quint16 min, quint16 max, QObject *parent = nullptr);
+    void Cancel();
+
+public slots:
+    void Run();
+
+signals:
+    void Progress(int percentage);
+    void Finished(int result);
+
+private:
+    void ReportProgress(quint8 percentage);
+
+    quint16 minSong;
+    quint16 maxSong;
+    QAtomicInt cancelled;
+    QElapsedTimer progressTimer;
+};
+
+#endif // EXTRACTION_WORKER_H
@@ -2,23 +2,39 @@
 #define GBA_MUSIC_UTILS_H
 
 #include <QByteArray>
+#include <QList>
+#include <functional>
 #include "include/globals.h"
-#include "include/mainwindow.h"
 
 #define SONG_TABLE_PADDING  8
+#define SONG_TABLE_MAX_ENTRY 999       //romSongTableSize stops counting here
 #define SONG_MS_OFFSET 4
 #define SONG_ME_OFFSET 6
+#define SONG_HEADER_LENGTH 8
+#define SAMPLE_FLAGS_OFFSET 0x0
+#define SAMPLE_PITCH_OFFSET 0x4
+#define SAMPLE_LOOP_OFFSET 0x8
 #define SAMPLE_LENGTH_OFFSET 0xC
+#define SAMPLE_FLAG_COMPRESSED 0x1
+#define SAMPLE_FLAG_LOOP 0x40000000
 #define VG_SIZE 128
 #define VG_ENTRY_LENGTH 0xC
 #define SAMPLE_HEADER_LENGTH 0x10
 #define REVERB_MASK 0x7F
 #define STD_REVERB  50
+#define STAGING_SUFFIX ".partial"
+#define BACKUP_SUFFIX ".previous"    //Files replaced while publishing, until every one is in place
 
 enum {INSTRUMENT_NORMAL, INSTRUMENT_ALT, INSTRUMENT_NO_RESAMPLE};
+enum {EXTRACTION_SUCCESS, EXTRACTION_FAILED, EXTRACTION_CANCELLED};
+
+typedef std::function<void(quint8 percentage)> ProgressCallback;
+typedef std::function<bool()> CancelCallback;
 
 void InitROMData(bool unkownRom);
-void ExtractROMSongData(quint16 min, quint16 max, MainWindow* mw);
-void BuildSongFiles();
+quint8 ExtractROMSongData(quint16 min, quint16 max, ProgressCallback progress, CancelCallback cancelled);
+bool BuildSongFiles();
+bool RenderSongs(QString folder);
+QList<QList<quint32> > NearDuplicateSamples();
 
 #endif // GBA_MUSIC_UTILS_H
@@ -3,21 +3,29 @@
 
 #include <QtGlobal>
 #include <QString>
+#include "include/rom_view.h"
 
 QT_BEGIN_NAMESPACE
 class QFile;
 class QStringList;
 QT_END_NAMESPACE
 
+struct RomProfile;
+
 const QString SOUND_DIR = "/sound";
 const QString CONSTANTS_DIR = "/include/constants";
 const QString PW_SAMPLE_DIR = "sound/programmable_wave_samples";
 const QString DS_SAMPLE_DIR = "sound/direct_sound_samples";
 const QString MIDI_DIR = "sound/songs/midi";
+const QString SONGS_DIR = "sound/songs";
 const QString VG_DIR = "/sound/voicegrups";
 
 const QString PWS_EXTENSION = ".pcm";
 const QString BIN_EXTENSION = ".bin";
+const QString AIF_EXTENSION = ".aif";
+const QString WAV_EXTENSION = ".wav";
+const QString MIDI_EXTENSION = ".mid";
+const QString ASM_EXTENSION = ".s";
 
 const QString PWAVE_DATA_FILE = "/sound/programmable_wave_data.inc";
 const QString DSOUND_DATA_FILE = "/sound/direct_sound_data.inc";
@@ -49,9 +57,10 @@ struct Instrument {
     quint8 data[11];
 };
 
+//Raw ToneData of every slot, the text is only rendered by the file writer
 struct VoiceGroup {
     quint32 offset;
-    struct Instrument instruments[256];
+    struct Instrument instruments[128];
 };
 
 struct DirectSound {
@@ -94,6 +103,13 @@ struct VoiceKeysplit {
     quint32 keysplit;
 };
 
+struct SampleHeader {
+    quint32 flags;
+    quint32 pitch;          //Sample rate * 1024
+    quint32 loopStart;
+    quint32 size;           //Number of samples - 1
+};
+
 #define DIRECT_SOUND        0x00
 #define DIRECT_SOUND_NO_R   0x08
 #define DIRECT_SOUND_ALT    0x10
@@ -107,12 +123,20 @@ struct VoiceKeysplit {
 #define VOICE_NOISE_ALT     0x0C
 #define VOICE_KEYSPLIT      0x40
 #define VOICE_KEYSPLIT_ALL  0x80
+#define VOICE_PLACEHOLDER   0xFF    //Entry that couldn't be parsed
 
 #define KEYSPLIT_MAX_ELEMENTS 0x80
 
+enum {SAMPLE_FORMAT_AIF, SAMPLE_FORMAT_BIN, SAMPLE_FORMAT_WAV};
+enum {NEAR_DUPLICATES_OFF, NEAR_DUPLICATES_REPORT, NEAR_DUPLICATES_MERGE};
+enum {SONG_FORMAT_MIDI, SONG_FORMAT_ASM};
+
 extern QFile romFile;
 extern QByteArray romHex;
-extern quint8 romType;
+extern RomView rom;
+extern const RomProfile *romProfile;
+extern quint32 romCrc32;
+extern quint8 romDumpStatus;
 extern quint32 romSongTableOffset;
 extern quint32 romSongTableSize;
 
@@ -129,5 +153,10 @@ extern bool romReady;
 extern bool pretReady;
 extern bool automaticSongNames;
 extern bool overridePret;
+extern int sampleWorkers;
+extern quint8 sampleFormat;
+extern quint32 sampleRate;
+extern quint8 nearDuplicateMode;
+extern quint8 songFormat;
 
 #endif // GLOBALS_H
@@ -0,0 +1,34 @@
+#ifndef M4A_DISASSEMBLER_H
+#define M4A_DISASSEMBLER_H
+
+#include <QString>
+#include <QVector>
+#include "include/m4a_sequence.h"
+
+#define ASM_MAX_JUMP_DEPTH 16           //Nested PATT, REPT and MEMACC, deeper is a bad track
+
+enum {ASM_LABEL_NONE, ASM_LABEL_TRACK, ASM_LABEL_BRANCH, ASM_LABEL_PATTERN};
+
+//One command of the listing, where it is and who reaches it
+struct AsmCommand {
+    quint32 offset;
+    M4aCommand m4a;         //As M4aReadCommand reads it
+    quint8 track;           //First track reaching it, from 0
+    quint8 label;           //ASM_LABEL_*
+};
+
+//Every command a song can reach, with the places jumps go to marked
+struct SongListing {
+    quint32 header;
+    quint8 blocks;
+    quint8 priority;
+    quint8 reverb;
+    quint32 voiceGroup;
+    QVector<quint32> tracks;        //First command of each track
+    QVector<AsmCommand> commands;   //In ROM order
+};
+
+SongListing DisassembleSong(const RomView &rom, quint32 songHeader);
+QString SongListingToAsm(const SongListing &listing, const QString &name, const QString &voiceGroup);
+
+#endif // M4A_DISASSEMBLER_H
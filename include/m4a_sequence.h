@@ -0,0 +1,107 @@
+#ifndef M4A_SEQUENCE_H
+#define M4A_SEQUENCE_H
+
+#include <QtGlobal>
+#include <QVector>
+#include "include/rom_view.h"
+
+#define M4A_MAX_TRACKS 16
+#define M4A_TRACK_POINTERS_OFFSET 8     //Right after the 8 byte SongHeader
+#define M4A_TICKS_PER_BEAT 24
+#define M4A_CALL_DEPTH 3                //PATT nesting the sound driver allows
+#define M4A_MAX_COMMANDS 0x100000       //Per track, a runaway REPT is a bad track
+#define M4A_NO_LOOP 0xFFFFFFFF
+
+//m4a (MPlayDef.s) commands
+#define M4A_WAIT_FIRST  0x80            //W00
+#define M4A_WAIT_LAST   0xB0            //W96
+#define M4A_FINE        0xB1
+#define M4A_GOTO        0xB2
+#define M4A_PATT        0xB3
+#define M4A_PEND        0xB4
+#define M4A_REPT        0xB5
+#define M4A_MEMACC      0xB9
+#define M4A_PRIO        0xBA
+#define M4A_TEMPO       0xBB
+#define M4A_KEYSH       0xBC
+#define M4A_VOICE       0xBD            //First command kept for running status
+#define M4A_VOL         0xBE
+#define M4A_PAN         0xBF
+#define M4A_BEND        0xC0
+#define M4A_BENDR       0xC1
+#define M4A_LFOS        0xC2
+#define M4A_LFODL       0xC3
+#define M4A_MOD         0xC4
+#define M4A_MODT        0xC5
+#define M4A_TUNE        0xC8
+#define M4A_XCMD        0xCD
+#define M4A_EOT         0xCE
+#define M4A_TIE         0xCF
+#define M4A_NOTE_FIRST  0xD0            //N01
+#define M4A_NOTE_LAST   0xFF            //N96
+
+#define M4A_XCMD_XXX    0x00            //Ends the track like FINE
+#define M4A_XCMD_XXX_3  0x03            //ply_xxx again in gXcmdTable
+#define M4A_XCMD_XWAVE  0x01            //4 byte argument, the wave data pointer
+#define M4A_XCMD_0C     0x0C            //2 byte argument
+#define M4A_XCMD_0D     0x0D            //4 byte argument, the last type in gXcmdTable
+
+#define M4A_MEMACC_FIRST_JUMP 6         //MEMACC operations from this one have a pointer
+#define M4A_MAX_ARGUMENTS 5             //XCMD: type and a 4 byte argument
+
+//What a command does, every byte maps to one
+enum {M4A_KIND_INVALID, M4A_KIND_WAIT, M4A_KIND_NOTE, M4A_KIND_TIE, M4A_KIND_EOT, M4A_KIND_FINE, M4A_KIND_GOTO,
+      M4A_KIND_PATT, M4A_KIND_PEND, M4A_KIND_REPT, M4A_KIND_MEMACC, M4A_KIND_XCMD, M4A_KIND_ARGUMENT};
+
+//One command as it is stored in the ROM
+struct M4aCommand {
+    quint8 command;         //M4A_*, the running one when the command byte is left out
+    quint8 kind;            //M4A_KIND_*
+    bool running;           //Starts with an argument, repeats the last command
+    quint8 length;          //Bytes, pointer included
+    quint8 argCount;        //Optional ones of notes, TIE and EOT included when present
+    quint8 args[M4A_MAX_ARGUMENTS];
+    bool hasTarget;
+    quint32 target;         //GOTO, PATT, REPT and MEMACC jumps
+};
+
+//One event of a track, 8 bytes. Control flow (GOTO, PATT, REPT...) is already
+//followed so events are in tick order and only the ones that make sound are kept
+struct SequenceEvent {
+    quint32 tick;           //Since the start of the song, M4A_TICKS_PER_BEAT per beat
+    quint8 command;         //M4A_*, notes are M4A_NOTE_FIRST whatever their length
+    quint8 args[3];         //Note: key, velocity, length in ticks. TIE: key, velocity.
+                            //EOT: key. MEMACC: operation, address, data. XCMD: type, value.
+                            //Others: their argument
+};
+
+struct SequenceTrack {
+    quint32 offset;         //First command in the ROM
+    quint32 firstEvent;     //Events of the track are [firstEvent, firstEvent + eventCount)
+    quint32 eventCount;
+    quint32 endTick;        //Tick of FINE or GOTO
+    quint32 loopTick;       //Where the GOTO at endTick goes back to, M4A_NO_LOOP if it doesn't
+};
+
+struct SongSequence {
+    quint32 header;
+    QVector<SequenceTrack> tracks;
+    QVector<SequenceEvent> events;  //Every track, one after the other
+};
+
+//Track blocks decoded in the run and the ones taken from the cache
+struct SequenceCacheStats {
+    quint32 decoded;
+    quint32 reused;
+};
+
+SongSequence DecodeSongSequence(const RomView &rom, quint32 songHeader);
+void ClearSequenceCache();
+void ResetSequenceCacheStats();
+SequenceCacheStats GetSequenceCacheStats();
+M4aCommand M4aReadCommand(const RomView &rom, quint32 offset, quint8 running);
+quint8 M4aCommandTicks(quint8 command);
+quint8 M4aXcmdArgumentLength(quint8 type);
+bool M4aXcmdEndsTrack(quint8 type);
+
+#endif // M4A_SEQUENCE_H
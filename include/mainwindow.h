@@ -5,8 +5,11 @@
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
+class QThread;
 QT_END_NAMESPACE
 
+class ExtractionWorker;
+
 class MainWindow : public QMainWindow
 {
     Q_OBJECT
@@ -14,7 +17,7 @@ class MainWindow : public QMainWindow
 public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
-    void SetPercentage(quint8 percentage);
+    void SetPercentage(int percentage);
 
 private slots:
     void on_pushButton_File_clicked();
@@ -23,6 +26,10 @@ private slots:
 
     void on_pushButton_Extract_clicked();
 
+    void on_pushButton_Cancel_clicked();
+
+    void ExtractionFinished(int result);
+
     void UpdateRomLabels(bool unkown);
 
     void UpdatePretLabels();
@@ -34,6 +41,10 @@ private slots:
     void EnableExtract();
 
 private:
+    void SetExtracting(bool extracting);
+
     Ui::MainWindow *ui;
+    QThread *extractionThread;
+    ExtractionWorker *extractionWorker;
 };
 #endif // MAINWINDOW_H
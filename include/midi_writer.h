@@ -0,0 +1,13 @@
+#ifndef MIDI_WRITER_H
+#define MIDI_WRITER_H
+
+#include <QByteArray>
+#include "include/m4a_sequence.h"
+
+#define MIDI_TICKS_PER_BEAT M4A_TICKS_PER_BEAT     //m4a ticks are written as they are
+#define MIDI_LOOP_START_MARKER "["                  //mid2agb's loop markers
+#define MIDI_LOOP_END_MARKER "]"
+
+QByteArray SequenceToMidi(const SongSequence &sequence);
+
+#endif // MIDI_WRITER_H
@@ -0,0 +1,122 @@
+#ifndef OFFSET_INDEX_H
+#define OFFSET_INDEX_H
+
+#include <QtGlobal>
+#include <QVector>
+
+#define OFFSET_INDEX_MIN_BITS 6
+
+//Set of ROM offsets that keeps insertion order. Every offset gets a dense
+//index (0, 1, 2...) in the order it was added, lookups are an open addressing
+//hash table so they stay O(1) no matter how many samples a ROM has
+class OffsetSet
+{
+public:
+    OffsetSet() : bits(0) {}
+
+    int Size() const { return keys.size(); }
+    bool IsEmpty() const { return keys.isEmpty(); }
+    quint32 At(int index) const { return keys[index]; }
+    bool Contains(quint32 offset) const { return IndexOf(offset) >= 0; }
+
+    //Dense index of the offset, -1 if it isn't in the set
+    int IndexOf(quint32 offset) const
+    {
+        if (slots.isEmpty())
+            return -1;
+
+        for (quint32 slot = Slot(offset);; slot = (slot + 1) & Mask())
+        {
+            if (slots[slot] == 0)
+                return -1;
+            if (keys[slots[slot] - 1] == offset)
+                return slots[slot] - 1;
+        }
+    }
+
+    //Adds the offset if new, returns its index either way
+    int Insert(quint32 offset)
+    {
+        int index = IndexOf(offset);
+
+        if (index >= 0)
+            return index;
+
+        //Keeps the table at most half full
+        if ((keys.size() + 1) * 2 > slots.size())
+            Rehash(bits == 0 ? OFFSET_INDEX_MIN_BITS : bits + 1);
+
+        keys.append(offset);
+        Place(offset, keys.size());
+
+        return keys.size() - 1;
+    }
+
+    void Clear()
+    {
+        keys.clear();
+        slots.clear();
+        bits = 0;
+    }
+
+private:
+    quint32 Mask() const { return (1u << bits) - 1; }
+
+    //Fibonacci hashing, ROM offsets are often aligned so the low bits alone are poor
+    quint32 Slot(quint32 offset) const { return (offset * 0x9E3779B1u) >> (32 - bits); }
+
+    void Place(quint32 offset, quint32 entry)
+    {
+        quint32 slot = Slot(offset);
+
+        while (slots[slot] != 0)
+            slot = (slot + 1) & Mask();
+        slots[slot] = entry;
+    }
+
+    void Rehash(int newBits)
+    {
+        bits = newBits;
+        slots.fill(0, 1 << bits);
+
+        for (int i=0; i<keys.size(); i++)
+            Place(keys[i], i + 1);
+    }
+
+    QVector<quint32> keys;      //Offsets in insertion order
+    QVector<quint32> slots;     //Index + 1 into keys, 0 is an empty slot
+    int bits;
+};
+
+//Map from ROM offset to T with the same ordering and dense indexes as OffsetSet
+template <typename T>
+class OffsetIndex : public OffsetSet
+{
+public:
+    T &Value(int index) { return values[index]; }
+    const T &Value(int index) const { return values[index]; }
+
+    //Adds the offset with the given value if new, returns its index either way
+    int Insert(quint32 offset, const T &value)
+    {
+        int index = OffsetSet::Insert(offset);
+
+        if (index == values.size())
+            values.append(value);
+
+        return index;
+    }
+
+    void Clear()
+    {
+        OffsetSet::Clear();
+        values.clear();
+    }
+
+private:
+    using OffsetSet::Insert;
+
+    QVector<T> values;
+};
+
+#endif // OFFSET_INDEX_H
@@ -0,0 +1,18 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <QtGlobal>
+#include <QVector>
+
+#define RESAMPLE_TAPS 16        //Kernel length, a multiple of 4 (one SSE register)
+#define RESAMPLE_PHASES 512     //Fractional positions the kernel is tabulated at
+#define RESAMPLE_NO_LOOP -1
+
+struct ResampledPcm {
+    QVector<qint8> samples;
+    qint32 loopStart;           //RESAMPLE_NO_LOOP if the sample doesn't loop
+};
+
+ResampledPcm ResamplePcm(const qint8 *samples, quint32 length, qint32 loopStart, double fromRate, double toRate);
+
+#endif // RESAMPLER_H
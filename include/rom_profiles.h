@@ -0,0 +1,25 @@
+#ifndef ROM_PROFILES_H
+#define ROM_PROFILES_H
+
+#include <QtGlobal>
+#include <QString>
+#include <QList>
+
+#define ROM_PROFILES_FILE "rom_profiles.json"
+
+enum {ROM_DUMP_UNVERIFIED, ROM_DUMP_CLEAN, ROM_DUMP_MODIFIED};
+
+struct RomProfile {
+    QString code;                   //Game code at ROM_HEADER_OFFSET
+    QString name;
+    quint32 songTablePointer;       //Offset of the pointer to the song table
+    quint32 songTablePointerAlt;
+    QList<quint32> crc32;           //CRC-32 of the known clean dumps
+};
+
+bool LoadRomProfiles(QString filePath);
+const RomProfile *FindRomProfile(quint32 gameCode);
+quint8 VerifyRomDump(const RomProfile *profile, quint32 crc);
+QString RomDumpStatusQString(quint8 status);
+
+#endif // ROM_PROFILES_H
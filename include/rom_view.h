@@ -0,0 +1,79 @@
+#ifndef ROM_VIEW_H
+#define ROM_VIEW_H
+
+#include <QtGlobal>
+#include <QtEndian>
+#include <QString>
+
+#define BINARY_POINTER_MASK 0x1FFFFFF
+
+//Contiguous piece of the ROM image, bounds are checked once when the span is created
+struct RomSpan {
+    const uchar *data;
+    quint32 length;
+
+    quint8 Byte(quint32 pos) const { return data[pos]; }
+    quint16 HWord(quint32 pos) const { return qFromLittleEndian<quint16>(data + pos); }
+    quint32 Word(quint32 pos) const { return qFromLittleEndian<quint32>(data + pos); }
+    quint32 Pointer(quint32 pos) const { return Word(pos) & BINARY_POINTER_MASK; }
+};
+
+//Read-only view of the loaded ROM image. No data is copied, every read is
+//little-endian and an out of range read throws a QString like the parsers do
+class RomView
+{
+public:
+    RomView() : base(nullptr), size(0) {}
+    RomView(const uchar *data, quint32 length) : base(data), size(length) {}
+
+    const uchar *Data() const { return base; }
+    quint32 Size() const { return size; }
+
+    bool Contains(quint32 offset, quint32 length) const
+    {
+        return offset <= size && length <= size - offset;
+    }
+
+    RomSpan ReadSpan(quint32 offset, quint32 length) const
+    {
+        CheckRange(offset, length);
+        RomSpan span = {base + offset, length};
+        return span;
+    }
+
+    quint8 ReadByte(quint32 offset) const
+    {
+        CheckRange(offset, 1);
+        return base[offset];
+    }
+
+    quint16 ReadHWord(quint32 offset) const
+    {
+        CheckRange(offset, 2);
+        return qFromLittleEndian<quint16>(base + offset);
+    }
+
+    quint32 ReadWord(quint32 offset) const
+    {
+        CheckRange(offset, 4);
+        return qFromLittleEndian<quint32>(base + offset);
+    }
+
+    //Reads a GBA pointer, 08->00 and 09->01 (ROM & Extended ROM)
+    quint32 ReadPointer(quint32 offset) const
+    {
+        return ReadWord(offset) & BINARY_POINTER_MASK;
+    }
+
+private:
+    void CheckRange(quint32 offset, quint32 length) const
+    {
+        if (!Contains(offset, length))
+            throw "ROM read out of range at 0x" + QString::number(offset, 16);
+    }
+
+    const uchar *base;
+    quint32 size;
+};
+
+#endif // ROM_VIEW_H
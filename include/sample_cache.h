@@ -0,0 +1,29 @@
+#ifndef SAMPLE_CACHE_H
+#define SAMPLE_CACHE_H
+
+#include <QtGlobal>
+#include <QString>
+#include "include/checksum.h"
+
+#define SAMPLE_CACHE_CONVERTER_VERSION 1    //Bump when pcm2aif or pcm2wav output changes
+#define SAMPLE_CACHE_DEFAULT_SIZE_MB 512
+#define SAMPLE_CACHE_STALE_TEMP_SECS 3600   //Temp files left by a crashed job
+
+struct SampleCacheStats {
+    quint32 hits;
+    quint32 misses;
+    quint32 stored;
+    quint32 evicted;
+};
+
+QString DefaultSampleCachePath();
+bool InitSampleCache(QString path, qint64 maxSize);
+void CloseSampleCache();
+bool IsSampleCacheEnabled();
+bool FetchCachedSample(Hash128 hash, quint8 baseNote, QString variant, QString dest);
+void StoreCachedSample(Hash128 hash, quint8 baseNote, QString variant, QString source);
+void TrimSampleCache();
+void ResetSampleCacheStats();
+SampleCacheStats GetSampleCacheStats();
+
+#endif // SAMPLE_CACHE_H
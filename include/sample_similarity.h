@@ -0,0 +1,28 @@
+#ifndef SAMPLE_SIMILARITY_H
+#define SAMPLE_SIMILARITY_H
+
+#include <QtGlobal>
+#include <QVector>
+
+#define FINGERPRINT_ENVELOPE_BINS 32    //Multiple of 4 (one SSE register)
+#define FINGERPRINT_MINHASH_BUCKETS 64  //Multiple of 4
+#define FINGERPRINT_SHINGLE_LENGTH 4    //Samples per MinHash window
+#define FINGERPRINT_QUANTIZE_SHIFT 2    //Bits dropped from each sample before hashing
+#define FINGERPRINT_SILENCE 2           //Trailing samples this quiet are padding
+
+#define NEAR_DUPLICATE_MIN_LENGTH_RATIO 0.9
+#define NEAR_DUPLICATE_MAX_ENVELOPE_DISTANCE 0.04
+#define NEAR_DUPLICATE_MIN_SIMILARITY 0.85
+
+struct SampleFingerprint {
+    quint32 length;                                     //Without trailing silence
+    float envelope[FINGERPRINT_ENVELOPE_BINS];          //RMS of each bin, 1 is full scale
+    quint32 minHash[FINGERPRINT_MINHASH_BUCKETS];
+};
+
+SampleFingerprint FingerprintPcm(const qint8 *samples, quint32 length);
+float EnvelopeDistance(const SampleFingerprint &a, const SampleFingerprint &b);
+float MinHashSimilarity(const SampleFingerprint &a, const SampleFingerprint &b);
+QVector<int> ClusterFingerprints(const QVector<SampleFingerprint> &fingerprints);
+
+#endif // SAMPLE_SIMILARITY_H
@@ -0,0 +1,46 @@
+#ifndef SONG_RENDERER_H
+#define SONG_RENDERER_H
+
+#include <QByteArray>
+#include <QVector>
+#include "include/m4a_sequence.h"
+
+#define RENDER_SAMPLE_RATE 44100
+#define RENDER_FRAME_RATE 59.7275       //The sound driver runs once per VBlank
+#define RENDER_LOOPS 2                  //Times the loop of a looping song is played
+#define RENDER_MAX_SECONDS 900          //A song that never ends is cut here
+#define RENDER_NO_LOOP -1
+
+enum {RENDER_VOICE_SILENT, RENDER_VOICE_SAMPLE, RENDER_VOICE_FIXED};
+
+//DirectSound voice ready to be mixed. The PCM is in [-1, 1) and has one more
+//sample than length, a copy of the loop start (or 0) to interpolate against
+struct RenderVoice {
+    quint8 type;                //RENDER_VOICE_*, CGB voices are silent
+    QVector<float> pcm;
+    quint32 length;
+    qint32 loopStart;           //RENDER_NO_LOOP if the sample doesn't loop
+    double rate;                //Hz at key 60
+    quint8 key;                 //Played instead of the note in a rhythm instrument
+    quint8 pan;                 //0x80 | pan when it's set, only rhythm instruments use it
+    quint8 atk;
+    quint8 dec;
+    quint8 sus;
+    quint8 rel;
+};
+
+//One voicegroup slot. A keysplit picks one of its voices by the note, a
+//rhythm instrument (keysplit_all) has one voice per note
+struct RenderInstrument {
+    QVector<RenderVoice> voices;
+    QVector<quint8> split;      //Voice of each note, empty if there's only one voice
+    bool rhythm;
+};
+
+struct RenderVoiceGroup {
+    QVector<RenderInstrument> instruments;     //128, a slot that can't play has no voices
+};
+
+QByteArray RenderSongToWav(const SongSequence &sequence, const RenderVoiceGroup &voiceGroup, quint8 reverb);
+
+#endif // SONG_RENDERER_H
@@ -0,0 +1,22 @@
+#ifndef SONG_TABLE_LOCATOR_H
+#define SONG_TABLE_LOCATOR_H
+
+#include <QtGlobal>
+#include <QList>
+
+#define SONG_TABLE_MIN_ENTRIES 8
+#define SONG_TABLE_MAX_CANDIDATES 8
+#define SONG_ENTRY_MAX_PLAYER 0x3F
+#define SONG_HEADER_MAX_TRACKS 16
+#define LOCATOR_CHUNK_SIZE 0x100000
+
+struct SongTableCandidate {
+    quint32 offset;         //ROM offset of the first song table entry
+    quint32 entries;        //Number of consecutive valid entries
+    quint32 validHeaders;   //Entries pointing to a plausible SongHeader
+    bool signature;         //Referenced by the m4aSongNumStart routine
+};
+
+QList<SongTableCandidate> LocateSongTables();
+
+#endif // SONG_TABLE_LOCATOR_H
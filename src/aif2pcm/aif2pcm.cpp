@@ -24,6 +24,26 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <limits.h>
+#include "include/aif2pcm/aif2pcm.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define AIF_WRITEV
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DELTA_SSE2
+#endif
+
+// FORM, COMM, MARK, INST and the SSND chunk up to its sound data
+#define AIF_MAX_HEADER_LENGTH 114
+#define AIF_MAX_WRITE_PARTS 2
+// RIFF, fmt, smpl with one loop and the data chunk up to its samples
+#define WAV_MAX_HEADER_LENGTH 112
 
 /* extended.c */
 void ieee754_write_extended (double, uint8_t*);
@@ -351,6 +371,64 @@ const int gDeltaEncodingTable[] = {
     -64, -49, -36, -25, -16, -9, -4, -1,
 };
 
+// Both deltas of a packed byte, high nibble first, as two wrapped 8-bit values.
+static const uint8_t *get_delta_pair_table(void)
+{
+    static uint8_t table[256 * 2];
+    static bool ready = [] {
+        for (int i = 0; i < 256; i++)
+        {
+            table[i * 2] = (uint8_t)gDeltaEncodingTable[i >> 4];
+            table[i * 2 + 1] = (uint8_t)gDeltaEncodingTable[i & 0xf];
+        }
+        return true;
+    }();
+    (void)ready;
+    return table;
+}
+
+// Decodes one whole block: a base sample, the low nibble of the next byte
+// and 31 bytes of two deltas each. The deltas are looked up first and then
+// summed (mod 256) so there's no branch per sample.
+static void delta_decompress_block(const uint8_t *in, uint8_t *out)
+{
+    const uint8_t *pairs = get_delta_pair_table();
+    uint8_t deltas[DELTA_BLOCK_SAMPLES];
+
+    deltas[0] = in[0];
+    deltas[1] = (uint8_t)gDeltaEncodingTable[in[1] & 0xf];
+    for (int k = 0; k < 31; k++)
+    {
+        memcpy(&deltas[2 + k * 2], &pairs[in[2 + k] * 2], 2);
+    }
+
+#ifdef DELTA_SSE2
+    // Prefix sum of 16 bytes at a time, the last sum is carried to the next ones
+    __m128i carry = _mm_setzero_si128();
+    for (int n = 0; n < DELTA_BLOCK_SAMPLES; n += 16)
+    {
+        __m128i x = _mm_loadu_si128((const __m128i *)&deltas[n]);
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 1));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 2));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi8(x, carry);
+        _mm_storeu_si128((__m128i *)&out[n], x);
+
+        carry = _mm_unpackhi_epi8(x, x);
+        carry = _mm_unpackhi_epi16(carry, carry);
+        carry = _mm_shuffle_epi32(carry, 0xff);
+    }
+#else
+    uint8_t sum = 0;
+    for (int n = 0; n < DELTA_BLOCK_SAMPLES; n++)
+    {
+        sum += deltas[n];
+        out[n] = sum;
+    }
+#endif
+}
+
 struct Bytes *delta_decompress(struct Bytes *delta, unsigned int expected_length)
 {
     struct Bytes* pcm = (Bytes*)malloc(sizeof(struct Bytes));
@@ -362,6 +440,16 @@ struct Bytes *delta_decompress(struct Bytes *delta, unsigned int expected_length
     unsigned int j = 0;
     int k;
     int8_t base;
+
+    // Whole blocks first, the last one always goes through the loop below
+    // so it stops exactly where it did before
+    while (i + DELTA_BLOCK_BYTES <= delta->length && j + DELTA_BLOCK_SAMPLES < pcm->length)
+    {
+        delta_decompress_block(&delta->data[i], &pcm->data[j]);
+        i += DELTA_BLOCK_BYTES;
+        j += DELTA_BLOCK_SAMPLES;
+    }
+
     while (i < delta->length)
     {
         base = (int8_t)delta->data[i++];
@@ -438,29 +526,58 @@ int get_delta_index(uint8_t sample, uint8_t prev_sample)
     return best_index;
 }
 
-struct Bytes *delta_compress(struct Bytes *pcm)
+// Index of every (prev_sample, sample) pair, 64 KiB. The error isn't modular,
+// it depends on both values, so it can't be indexed by the difference alone.
+static const uint8_t *get_delta_index_table(void)
 {
-    struct Bytes* delta = (Bytes*) malloc(sizeof(struct Bytes));
-    // estimate the length so we can malloc
-    int num_blocks = pcm->length / 64;
-    delta->length = num_blocks * 33;
+    static uint8_t table[256 * 256];
+    static bool ready = [] {
+        for (int prev = 0; prev < 256; prev++)
+        {
+            for (int sample = 0; sample < 256; sample++)
+            {
+                table[(prev << 8) | sample] = get_delta_index(sample, prev);
+            }
+        }
+        return true;
+    }();
+    (void)ready;
+    return table;
+}
+
+// Bytes taken by num_samples delta compressed samples: whole 33 byte blocks,
+// then the base, the first delta byte and two samples per byte
+unsigned long delta_compressed_length(unsigned long num_samples)
+{
+    unsigned long length = (num_samples / DELTA_BLOCK_SAMPLES) * DELTA_BLOCK_BYTES;
 
-    int extra = pcm->length % 64;
+    int extra = num_samples % DELTA_BLOCK_SAMPLES;
     if (extra)
     {
-        delta->length += 1;
+        length += 1;
         extra -= 1;
     }
     if (extra)
     {
-        delta->length += 1;
+        length += 1;
         extra -= 1;
     }
     if (extra)
     {
-        delta->length += (extra + 1) / 2;
+        length += (extra + 1) / 2;
     }
 
+    return length;
+}
+
+struct Bytes *delta_compress(struct Bytes *pcm)
+{
+    const uint8_t *index_table = get_delta_index_table();
+
+    struct Bytes* delta = (Bytes*) malloc(sizeof(struct Bytes));
+    // estimate the length so we can malloc
+    delta->length = delta_compressed_length(pcm->length);
+
     delta->data = static_cast<uint8_t *>(malloc(delta->length + 33));
 
     unsigned int i = 0;
@@ -478,7 +595,7 @@ struct Bytes *delta_compress(struct Bytes *pcm)
         {
             break;
         }
-        delta_index = get_delta_index(pcm->data[i++], base);
+        delta_index = index_table[(base << 8) | pcm->data[i++]];
         base += gDeltaEncodingTable[delta_index];
         delta->data[j++] = delta_index;
 
@@ -488,7 +605,7 @@ struct Bytes *delta_compress(struct Bytes *pcm)
             {
                 break;
             }
-            delta_index = get_delta_index(pcm->data[i++], base);
+            delta_index = index_table[(base << 8) | pcm->data[i++]];
             base += gDeltaEncodingTable[delta_index];
             delta->data[j] = (delta_index << 4);
 
@@ -496,7 +613,7 @@ struct Bytes *delta_compress(struct Bytes *pcm)
             {
                 break;
             }
-            delta_index = get_delta_index(pcm->data[i++], base);
+            delta_index = index_table[(base << 8) | pcm->data[i++]];
             base += gDeltaEncodingTable[delta_index];
             delta->data[j++] |= delta_index;
         }
@@ -571,272 +688,427 @@ void aif2pcm(const char *aif_filename, const char *pcm_filename, bool compress)
     free(aif_data.samples);
 }
 
-// Reads a .pcm file containing an array of 8-bit samples and produces an .aif file.
-// See http://www-mmsp.ece.mcgill.ca/documents/audioformats/aiff/Docs/AIFF-1.3.pdf for .aif file specification.
-void pcm2aif(const char *pcm_filename, const char *aif_filename, uint32_t base_note)
+// Chunk builder for the .aif (big-endian) and .wav (little-endian) headers.
+// Every field is a fixed size store into a buffer sized for the header.
+struct ChunkWriter {
+    uint8_t *data;
+    unsigned long pos;
+    bool little_endian;     // ckSize byte order
+};
+
+static void put_u8(struct ChunkWriter *w, uint8_t value)
 {
-    struct Bytes *pcm = read_bytearray(pcm_filename);
+    w->data[w->pos++] = value;
+}
 
-    AifData* aif_data = (AifData*) malloc(sizeof(AifData));
+static void put_u16_be(struct ChunkWriter *w, uint16_t value)
+{
+    uint8_t bytes[2] = {uint8_t(value >> 8), uint8_t(value)};
+    memcpy(w->data + w->pos, bytes, 2);
+    w->pos += 2;
+}
+
+static void put_u32_be(struct ChunkWriter *w, uint32_t value)
+{
+    uint8_t bytes[4] = {uint8_t(value >> 24), uint8_t(value >> 16), uint8_t(value >> 8), uint8_t(value)};
+    memcpy(w->data + w->pos, bytes, 4);
+    w->pos += 4;
+}
+
+static void put_u16_le(struct ChunkWriter *w, uint16_t value)
+{
+    uint8_t bytes[2] = {uint8_t(value), uint8_t(value >> 8)};
+    memcpy(w->data + w->pos, bytes, 2);
+    w->pos += 2;
+}
+
+static void put_u32_le(struct ChunkWriter *w, uint32_t value)
+{
+    uint8_t bytes[4] = {uint8_t(value), uint8_t(value >> 8), uint8_t(value >> 16), uint8_t(value >> 24)};
+    memcpy(w->data + w->pos, bytes, 4);
+    w->pos += 4;
+}
+
+static void put_bytes(struct ChunkWriter *w, const uint8_t *bytes, unsigned long length)
+{
+    memcpy(w->data + w->pos, bytes, length);
+    w->pos += length;
+}
+
+static void put_id(struct ChunkWriter *w, const char *id)
+{
+    put_bytes(w, reinterpret_cast<const uint8_t *>(id), 4);
+}
+
+// Pascal-style string, no pad byte to keep the layout aif2pcm always wrote
+static void put_pstring(struct ChunkWriter *w, const char *str)
+{
+    uint8_t length = strlen(str);
+    put_u8(w, length);
+    put_bytes(w, reinterpret_cast<const uint8_t *>(str), length);
+}
+
+// Writes the chunk ID and a placeholder ckSize, returns where ckSize is
+static unsigned long begin_chunk(struct ChunkWriter *w, const char *id)
+{
+    put_id(w, id);
+    unsigned long size_pos = w->pos;
+    put_u32_be(w, 0);   // Same in both byte orders
+    return size_pos;
+}
+
+// Sets ckSize to everything written since begin_chunk, plus trailing_length
+// bytes that aren't in the buffer (the sound data)
+static void end_chunk(struct ChunkWriter *w, unsigned long size_pos, unsigned long trailing_length)
+{
+    unsigned long end = w->pos;
+    w->pos = size_pos;
+    if (w->little_endian)
+    {
+        put_u32_le(w, end - size_pos - 4 + trailing_length);
+    }
+    else
+    {
+        put_u32_be(w, end - size_pos - 4 + trailing_length);
+    }
+    w->pos = end;
+}
+
+// Writes the parts one after the other into a new file with a single gather write
+static bool write_gather(const char *filename, const struct Bytes *parts, int count)
+{
+#ifdef AIF_WRITEV
+    struct iovec iov[AIF_MAX_WRITE_PARTS];
+    int first = 0;
+
+    if (count > AIF_MAX_WRITE_PARTS)
+    {
+        return false;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        iov[i].iov_base = parts[i].data;
+        iov[i].iov_len = parts[i].length;
+    }
+
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    // writev may stop early, carry on from where it did
+    while (first < count)
+    {
+        ssize_t n = writev(fd, iov + first, count - first);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            close(fd);
+            return false;
+        }
+
+        while (first < count && size_t(n) >= iov[first].iov_len)
+        {
+            n -= iov[first++].iov_len;
+        }
+
+        if (first < count)
+        {
+            iov[first].iov_base = static_cast<uint8_t *>(iov[first].iov_base) + n;
+            iov[first].iov_len -= n;
+        }
+    }
+
+    return close(fd) == 0;
+#else
+    FILE *f = fopen(filename, "wb");
+    bool written = f != nullptr;
+
+    for (int i = 0; written && i < count; i++)
+    {
+        written = parts[i].length == 0 || fwrite(parts[i].data, parts[i].length, 1, f) == 1;
+    }
+
+    if (f)
+    {
+        written = fclose(f) == 0 && written;
+    }
+
+    return written;
+#endif
+}
+
+// Decodes the m4a sample header (0x10 bytes) in pcm_data into aif_data and points
+// pcm to the 8-bit samples, decompressing them if needed. Returns the decompressed
+// buffer the caller has to free, nullptr if pcm points into pcm_data.
+static struct Bytes *read_sample_buffer(const uint8_t *pcm_data, unsigned long pcm_length, AifData *aif_data, struct Bytes *pcm)
+{
+    struct Bytes *decompressed = nullptr;
+
+    pcm->length = pcm_length - 0x10;
+    pcm->data = const_cast<uint8_t *>(pcm_data) + 0x10;
 
     uint32_t flags;
-    LOAD_U32_LE(flags, pcm->data + 0);
+    LOAD_U32_LE(flags, pcm_data + 0);
     aif_data->has_loop = flags & 0x40000000;
     bool compressed = flags & 1;
 
     uint32_t pitch_adjust;
-    LOAD_U32_LE(pitch_adjust, pcm->data + 4);
+    LOAD_U32_LE(pitch_adjust, pcm_data + 4);
     aif_data->sample_rate = pitch_adjust / 1024.0;
 
-    LOAD_U32_LE(aif_data->loop_offset, pcm->data + 8);
-    LOAD_U32_LE(aif_data->num_samples, pcm->data + 12);
+    LOAD_U32_LE(aif_data->loop_offset, pcm_data + 8);
+    LOAD_U32_LE(aif_data->num_samples, pcm_data + 12);
     aif_data->num_samples += 1;
 
     if (compressed)
     {
-        struct Bytes *delta = pcm;
-        uint8_t *pcm_data = pcm->data;
-        delta->length -= 0x10;
-        delta->data += 0x10;
-        pcm = delta_decompress(delta, aif_data->num_samples);
-        free(pcm_data);
-        free(delta);
+        decompressed = delta_decompress(pcm, aif_data->num_samples);
+        *pcm = *decompressed;
     }
-    else
+
+    // The samples are only read, no need to copy them
+    aif_data->samples = pcm->data;
+
+    return decompressed;
+}
+
+// The 8-bit samples of the sample (0x10 byte header + data), decompressed if
+// needed, in a new buffer the caller has to free. nullptr if there's no header.
+uint8_t *read_sample_data(const uint8_t *pcm_data, unsigned long pcm_length, unsigned long *num_samples)
+{
+    if (pcm_length < 0x10)
+    {
+        return nullptr;
+    }
+
+    AifData sample_struct = {0,0,0,0,0,0,0};
+    struct Bytes sound_data;
+    struct Bytes *decompressed = read_sample_buffer(pcm_data, pcm_length, &sample_struct, &sound_data);
+
+    uint8_t *samples = static_cast<uint8_t *>(malloc(sound_data.length + 1));
+    memcpy(samples, sound_data.data, sound_data.length);
+    *num_samples = sound_data.length;
+
+    if (decompressed)
     {
-        pcm->length -= 0x10;
-        pcm->data += 0x10;
-    }
-
-    aif_data->samples = static_cast<uint8_t *>(malloc(pcm->length));
-    memcpy(aif_data->samples, pcm->data, pcm->length);
-
-    //int *numberArray = calloc(n, sizeof(int));
-    //int* numberArray = (int*)calloc(n, sizeof(int));
-    //struct Bytes *aif = malloc(sizeof(struct Bytes));
-    struct Bytes* aif = (Bytes*)malloc(sizeof(struct Bytes));
-    aif->length = 54 + 60 + pcm->length;
-    aif->data = static_cast<uint8_t *>(malloc(aif->length));
-
-    long pos = 0;
-
-    // First, write the FORM header chunk.
-    // FORM Chunk ckID
-    aif->data[pos++] = 'F';
-    aif->data[pos++] = 'O';
-    aif->data[pos++] = 'R';
-    aif->data[pos++] = 'M';
-
-    // FORM Chunk ckSize
-    unsigned long form_size = pos;
-    unsigned long data_size = aif->length - 8;
-    aif->data[pos++] = ((data_size >> 24) & 0xFF);
-    aif->data[pos++] = ((data_size >> 16) & 0xFF);
-    aif->data[pos++] = ((data_size >>  8) & 0xFF);
-    aif->data[pos++] = (data_size & 0xFF);
-
-    // FORM Chunk formType
-    aif->data[pos++] = 'A';
-    aif->data[pos++] = 'I';
-    aif->data[pos++] = 'F';
-    aif->data[pos++] = 'F';
-
-    // Next, write the Common Chunk
-    // Common Chunk ckID
-    aif->data[pos++] = 'C';
-    aif->data[pos++] = 'O';
-    aif->data[pos++] = 'M';
-    aif->data[pos++] = 'M';
-
-    // Common Chunk ckSize
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 18;
-
-    // Common Chunk numChannels
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 1;  // 1 channel
-
-    // Common Chunk numSampleFrames
-    aif->data[pos++] = ((aif_data->num_samples >> 24) & 0xFF);
-    aif->data[pos++] = ((aif_data->num_samples >> 16) & 0xFF);
-    aif->data[pos++] = ((aif_data->num_samples >> 8)  & 0xFF);
-    aif->data[pos++] = (aif_data->num_samples & 0xFF);
-
-    // Common Chunk sampleSize
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 8;  // 8 bits per sample
-
-    // Common Chunk sampleRate
-    //double sample_rate = pitch_adjust / 1024.0;
+        free_bytearray(decompressed);
+    }
+
+    return samples;
+}
+
+// Reads a .pcm file containing an array of 8-bit samples and produces an .aif file.
+void pcm2aif(const char *pcm_filename, const char *aif_filename, uint32_t base_note)
+{
+    struct Bytes *pcm = read_bytearray(pcm_filename);
+
+    if (!pcm2aif_buffer(pcm->data, pcm->length, aif_filename, base_note))
+    {
+        FATAL_ERROR("Failed to open '%s' for writing!\n", aif_filename);
+    }
+
+    free_bytearray(pcm);
+}
+
+// Same as pcm2aif, but the sample (0x10 byte header + data) is already in memory,
+// e.g. mapped straight from the ROM. Only the header is built, it's written together
+// with the sound data in a single call, returns false if it couldn't be written.
+// See http://www-mmsp.ece.mcgill.ca/documents/audioformats/aiff/Docs/AIFF-1.3.pdf for .aif file specification.
+bool pcm2aif_buffer(const uint8_t *pcm_data, unsigned long pcm_length, const char *aif_filename, uint32_t base_note)
+{
+    if (pcm_length < 0x10)
+    {
+        return false;
+    }
+
+    AifData aif_struct = {0,0,0,0,0,0,0};
+    AifData *aif_data = &aif_struct;
+    struct Bytes sound_data;
+    struct Bytes *pcm = &sound_data;
+    struct Bytes *decompressed = read_sample_buffer(pcm_data, pcm_length, aif_data, pcm);
+
+    // The header is built on the stack, the sound data is written straight from
+    // the sample (the ROM or the decompressed buffer), it's never copied
+    uint8_t header[AIF_MAX_HEADER_LENGTH];
+    struct ChunkWriter chunk = {header, 0, false};
+    struct ChunkWriter *w = &chunk;
+
+    // First, the FORM header chunk, its size includes the sound data
+    unsigned long form_size = begin_chunk(w, "FORM");
+    put_id(w, "AIFF");
+
+    // Common Chunk
+    unsigned long comm_size = begin_chunk(w, "COMM");
+    put_u16_be(w, 1);                        // numChannels
+    put_u32_be(w, aif_data->num_samples);    // numSampleFrames
+    put_u16_be(w, 8);                        // sampleSize, 8 bits per sample
+
     uint8_t sample_rate_buffer[10];
     ieee754_write_extended(aif_data->sample_rate, sample_rate_buffer);
-    for (int i = 0; i < 10; i++)
+    put_bytes(w, sample_rate_buffer, 10);    // sampleRate
+    end_chunk(w, comm_size, 0);
+
+    if (aif_data->has_loop)
     {
-        aif->data[pos++] = sample_rate_buffer[i];
+        // Marker Chunk
+        unsigned long mark_size = begin_chunk(w, "MARK");
+        put_u16_be(w, 2);                        // numMarkers
+
+        put_u16_be(w, 1);                        // id
+        put_u32_be(w, aif_data->loop_offset);    // position
+        put_pstring(w, "START");                 // markerName
+
+        put_u16_be(w, 2);
+        put_u32_be(w, aif_data->num_samples);
+        put_pstring(w, "END");
+        end_chunk(w, mark_size, 0);
     }
 
-    if (aif_data->has_loop)
+    // Instrument Chunk
+    unsigned long inst_size = begin_chunk(w, "INST");
+    put_u8(w, base_note);   // baseNote
+    put_u8(w, 0);           // detune
+    put_u8(w, 0);           // lowNote
+    put_u8(w, 127);         // highNote
+    put_u8(w, 1);           // lowVelocity
+    put_u8(w, 127);         // highVelocity
+    put_u16_be(w, 0);       // gain
+
+    // sustainLoop and releaseLoop, ForwardLooping from marker 1 to marker 2
+    for (int i = 0; i < 2; i++)
     {
+        put_u16_be(w, 1);   // playMode
+        put_u16_be(w, 1);   // beginLoop marker id
+        put_u16_be(w, 2);   // endLoop marker id
+    }
+    end_chunk(w, inst_size, 0);
 
-        // Marker Chunk ckID
-        aif->data[pos++] = 'M';
-        aif->data[pos++] = 'A';
-        aif->data[pos++] = 'R';
-        aif->data[pos++] = 'K';
-
-        // Marker Chunk ckSize
-        aif->data[pos++] = 0;
-        aif->data[pos++] = 0;
-        aif->data[pos++] = 0;
-        aif->data[pos++] = 12 + (aif_data->has_loop ? 12 : 0);
-
-        // Marker Chunk numMarkers
-        aif->data[pos++] = 0;
-        aif->data[pos++] = (aif_data->has_loop ? 2 : 1);
-
-        // Marker loop start
-        aif->data[pos++] = 0;
-        aif->data[pos++] = 1;  // id = 1
-
-        long loop_start = aif_data->loop_offset;
-        aif->data[pos++] = ((loop_start >> 24) & 0xFF);
-        aif->data[pos++] = ((loop_start >> 16) & 0xFF);
-        aif->data[pos++] = ((loop_start >> 8)  & 0xFF);
-        aif->data[pos++] = (loop_start & 0xFF);  // position
-
-        aif->data[pos++] = 5;  // pascal-style string length
-        aif->data[pos++] = 'S';
-        aif->data[pos++] = 'T';
-        aif->data[pos++] = 'A';
-        aif->data[pos++] = 'R';
-        aif->data[pos++] = 'T';  // markerName
-
-        // Marker loop end
-        aif->data[pos++] = 0;
-        aif->data[pos++] = (aif_data->has_loop ? 2 : 1);  // id = 2
-
-        long loop_end = aif_data->num_samples;
-        aif->data[pos++] = ((loop_end >> 24) & 0xFF);
-        aif->data[pos++] = ((loop_end >> 16) & 0xFF);
-        aif->data[pos++] = ((loop_end >> 8)  & 0xFF);
-        aif->data[pos++] = (loop_end & 0xFF);  // position
-
-        aif->data[pos++] = 3;  // pascal-style string length
-        aif->data[pos++] = 'E';
-        aif->data[pos++] = 'N';
-        aif->data[pos++] = 'D';
-    }
-
-    // Instrument Chunk ckID
-    aif->data[pos++] = 'I';
-    aif->data[pos++] = 'N';
-    aif->data[pos++] = 'S';
-    aif->data[pos++] = 'T';
-
-    // Instrument Chunk ckSize
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 20;
-
-    aif->data[pos++] = base_note;  // baseNote
-    aif->data[pos++] = 0;          // detune
-    aif->data[pos++] = 0;          // lowNote
-    aif->data[pos++] = 127;        // highNote
-    aif->data[pos++] = 1;          // lowVelocity
-    aif->data[pos++] = 127;        // highVelocity
-    aif->data[pos++] = 0;          // gain (hi)
-    aif->data[pos++] = 0;          // gain (lo)
-
-    // Instrument Chunk sustainLoop
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 1; // playMode = ForwardLooping
-
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 1;  // beginLoop marker id
-
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 2;  // endLoop marker id
-
-        // Instrument Chunk releaseLoop
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 1; // playMode = ForwardLooping
-
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 1;  // beginLoop marker id
-
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 2;  // endLoop marker id
-
-    // Finally, write the Sound Data Chunk
-    // Sound Data Chunk ckID
-    aif->data[pos++] = 'S';
-    aif->data[pos++] = 'S';
-    aif->data[pos++] = 'N';
-    aif->data[pos++] = 'D';
-
-    // Sound Data Chunk ckSize
-    unsigned long sound_data_size = pcm->length + 8;
-    aif->data[pos++] = ((sound_data_size >> 24) & 0xFF);
-    aif->data[pos++] = ((sound_data_size >> 16) & 0xFF);
-    aif->data[pos++] = ((sound_data_size >> 8)  & 0xFF);
-    aif->data[pos++] = (sound_data_size & 0xFF);
-
-    // Sound Data Chunk offset
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 0;
-
-    // Sound Data Chunk blockSize
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 0;
-    aif->data[pos++] = 0;
-
-    // Sound Data Chunk soundData
-    for (unsigned int i = 0; i < aif_data->loop_offset; i++)
-    {
-        aif->data[pos++] = aif_data->samples[i];
-    }
-
-    int j = 0;
-    for (unsigned int i = aif_data->loop_offset; i < pcm->length; i++)
-    {
-        int pcm_index = aif_data->loop_offset + (j++ % (pcm->length - aif_data->loop_offset));
-        aif->data[pos++] = aif_data->samples[pcm_index];
-    }
-
-    aif->length = pos;
+    // Finally, the Sound Data Chunk. The samples are stored as they are, the loop
+    // is only described by the markers
+    unsigned long ssnd_size = begin_chunk(w, "SSND");
+    put_u32_be(w, 0);       // offset
+    put_u32_be(w, 0);       // blockSize
+    end_chunk(w, ssnd_size, pcm->length);
 
-    // Go back and rewrite ckSize
-    data_size = aif->length - 8;
-    aif->data[form_size + 0] = ((data_size >> 24) & 0xFF);
-    aif->data[form_size + 1] = ((data_size >> 16) & 0xFF);
-    aif->data[form_size + 2] = ((data_size >>  8) & 0xFF);
-    aif->data[form_size + 3] = (data_size & 0xFF);
+    end_chunk(w, form_size, pcm->length);
 
-    write_bytearray(aif_filename, aif);
+    struct Bytes parts[2] = {{w->pos, header}, {pcm->length, aif_data->samples}};
+    bool written = write_gather(aif_filename, parts, 2);
 
-    free(aif->data);
-    free(aif);
+    if (decompressed)
+    {
+        free_bytearray(decompressed);
+    }
+
+    return written;
 }
 
-void usage(void)
+// Writes the sample (0x10 byte header + data) as it is, the .bin pret's
+// direct_sound_data.inc includes. base_note is only there to match pcm2aif_buffer.
+bool pcm2bin_buffer(const uint8_t *pcm_data, unsigned long pcm_length, const char *bin_filename, uint32_t base_note)
 {
-    fprintf(stderr, "Usage: aif2pcm bin_file [aif_file]\n");
-    fprintf(stderr, "       aif2pcm aif_file [bin_file] [--compress]\n");
+    (void)base_note;
+
+    struct Bytes parts[1] = {{pcm_length, const_cast<uint8_t *>(pcm_data)}};
+    return write_gather(bin_filename, parts, 1);
 }
 
-int main_aif2pcm(char *input_file)
+// Same as pcm2aif_buffer, but produces an 8-bit mono .wav. The loop and the base
+// note go in a smpl chunk, WAV samples are unsigned so the data is converted.
+bool pcm2wav_buffer(const uint8_t *pcm_data, unsigned long pcm_length, const char *wav_filename, uint32_t base_note)
 {
-    char *output_file;
+    if (pcm_length < 0x10)
+    {
+        return false;
+    }
+
+    AifData wav_struct = {0,0,0,0,0,0,0};
+    AifData *wav_data = &wav_struct;
+    struct Bytes sound_data;
+    struct Bytes *pcm = &sound_data;
+    struct Bytes *decompressed = read_sample_buffer(pcm_data, pcm_length, wav_data, pcm);
+
+    uint32_t sample_rate = uint32_t(wav_data->sample_rate + 0.5);
+    unsigned long pad_length = pcm->length & 1;
+
+    uint8_t *samples = static_cast<uint8_t *>(malloc(pcm->length + pad_length));
+    for (unsigned long i = 0; i < pcm->length; i++)
+    {
+        samples[i] = wav_data->samples[i] ^ 0x80;
+    }
+    if (pad_length)
+    {
+        samples[pcm->length] = 0;
+    }
+
+    uint8_t header[WAV_MAX_HEADER_LENGTH];
+    struct ChunkWriter chunk = {header, 0, true};
+    struct ChunkWriter *w = &chunk;
+
+    unsigned long riff_size = begin_chunk(w, "RIFF");
+    put_id(w, "WAVE");
+
+    unsigned long fmt_size = begin_chunk(w, "fmt ");
+    put_u16_le(w, 1);               // PCM
+    put_u16_le(w, 1);               // 1 channel
+    put_u32_le(w, sample_rate);
+    put_u32_le(w, sample_rate);     // bytes per second
+    put_u16_le(w, 1);               // block align
+    put_u16_le(w, 8);               // 8 bits per sample
+    end_chunk(w, fmt_size, 0);
+
+    unsigned long smpl_size = begin_chunk(w, "smpl");
+    put_u32_le(w, 0);               // manufacturer
+    put_u32_le(w, 0);               // product
+    put_u32_le(w, sample_rate ? 1000000000 / sample_rate : 0);  // sample period (ns)
+    put_u32_le(w, base_note);       // MIDI unity note
+    put_u32_le(w, 0);               // MIDI pitch fraction
+    put_u32_le(w, 0);               // SMPTE format
+    put_u32_le(w, 0);               // SMPTE offset
+    put_u32_le(w, wav_data->has_loop ? 1 : 0);
+    put_u32_le(w, 0);               // sampler data
+
+    if (wav_data->has_loop)
+    {
+        // The end is the last sample played, not one past it like the aif END marker
+        unsigned long loop_end = pcm->length ? pcm->length - 1 : 0;
+        unsigned long loop_start = wav_data->loop_offset < loop_end ? wav_data->loop_offset : loop_end;
+
+        put_u32_le(w, 0);           // cue point id
+        put_u32_le(w, 0);           // forward loop
+        put_u32_le(w, loop_start);
+        put_u32_le(w, loop_end);
+        put_u32_le(w, 0);           // fraction
+        put_u32_le(w, 0);           // play count, 0 is infinite
+    }
+    end_chunk(w, smpl_size, 0);
+
+    unsigned long data_size = begin_chunk(w, "data");
+    end_chunk(w, data_size, pcm->length);
 
-    output_file = new_file_extension(input_file, "aif");
-    pcm2aif(input_file, output_file, 60);
-    free(output_file);
+    end_chunk(w, riff_size, pcm->length + pad_length);
+
+    struct Bytes parts[2] = {{w->pos, header}, {pcm->length + pad_length, samples}};
+    bool written = write_gather(wav_filename, parts, 2);
+
+    free(samples);
+    if (decompressed)
+    {
+        free_bytearray(decompressed);
+    }
+
+    return written;
+}
+
+void usage(void)
+{
+    fprintf(stderr, "Usage: aif2pcm bin_file [aif_file]\n");
+    fprintf(stderr, "       aif2pcm aif_file [bin_file] [--compress]\n");
 }
 
 /** Original aif2pcm main function **/
@@ -1,81 +1,74 @@
 #include "include/binary_utils.h"
 #include "include/globals.h"
+#include "include/checksum.h"
+#include "include/rom_profiles.h"
+#include <QDir>
+#include <cstdio>
 
-//Opens ROM file
-bool InitROMFile(QString filePath)
-{
-    romFile.setFileName(filePath);
+#ifdef Q_OS_WIN
+#include <windows.h>
+#endif
 
-    if (romFile.open(QIODevice::ReadOnly))
-    {
-        romHex = romFile.readAll();
-        romFile.close();
-        return true;
-    }
-    return false;
-}
+static const uchar *romMap = nullptr;   //Mapped ROM file, null when romHex is used
 
-//Checks the loaded ROM version
-bool CheckRomVersion()
+//Opens ROM file and maps it read-only into memory.
+//Pages are only loaded when the parsers touch them, if the file can't be
+//mapped the whole ROM is read into romHex instead
+bool InitROMFile(QString filePath)
 {
-    quint32 header = ReadROMWordAt(ROM_HEADER_OFFSET);
+    if (filePath.isEmpty() || !QFile::exists(filePath))
+        return false;
 
-    for (uint i=0; i < sizeof(ROM_HEADERS)/sizeof(ROM_HEADERS[0]); i++)
-        if (ROM_HEADERS[i] == header)
-        {
-            romType = i;
-            return true;
-        }
+    CloseROMFile();
+    romFile.setFileName(filePath);
 
-    return false;
-}
+    if (!romFile.open(QIODevice::ReadOnly))
+        return false;
 
-//Resolve the pointer at the given offset
-quint32 ResolveROMHexPointer(quint32 pointerOffset)
-{
-    quint32 destOffset = 0;
+    romMap = romFile.map(0, romFile.size());
 
-    for (int i = 3; i >= 0; i--)
+    if (romMap != nullptr)
+        rom = RomView(romMap, static_cast<quint32>(romFile.size()));
+    else
     {
-        destOffset += ReadROMByteAt(pointerOffset+i) << 8 * i;
+        romHex = romFile.readAll();
+        rom = RomView(reinterpret_cast<const uchar*>(romHex.constData()),
+                      static_cast<quint32>(romHex.size()));
     }
 
-    //transforms 08->00 and 09->01 (ROM & Extended ROM)
-    destOffset &= BINARY_POINTER_MASK;
-
-    return destOffset;
+    //The mapping stays valid after closing, until unmapped or romFile is reused
+    romFile.close();
+    return true;
 }
 
-//Reads the byte at the given ROM offset
-quint8 ReadROMByteAt(quint32 offset)
+//Releases the currently loaded ROM image
+void CloseROMFile()
 {
-    return static_cast<quint8>(romHex[offset]);;
+    if (romMap != nullptr)
+        romFile.unmap(const_cast<uchar*>(romMap));
+
+    romMap = nullptr;
+    romHex.clear();
+    rom = RomView();
 }
 
-//Reads the Half Word at the given ROM offset (16bit)
-quint16 ReadROMHWordAt(quint32 offset)
+//Checks the loaded ROM version and verifies the dump against its profile
+bool CheckRomVersion()
 {
-    quint16 hWord = 0;
+    romProfile = FindRomProfile(rom.ReadWord(ROM_HEADER_OFFSET));
 
-    for (int i=1; i>=0; i--)
-    {
-        hWord += ReadROMByteAt(offset + i) << 8 * i;
-    }
+    if (romProfile == nullptr)
+        return false;
 
-    return hWord;
+    romCrc32 = ParallelCrc32(rom.Data(), rom.Size());
+    romDumpStatus = VerifyRomDump(romProfile, romCrc32);
+    return true;
 }
 
-//Reads the word at the given ROM offset (32 bit)
-quint32 ReadROMWordAt(quint32 offset)
+//Resolve the pointer at the given offset
+quint32 ResolveROMHexPointer(quint32 pointerOffset)
 {
-    quint32 word = 0;
-
-    for (int i=3; i>=0; i--)
-    {
-        word += ReadROMByteAt(offset + i) << i * 8;
-    }
-
-    return word;
+    return rom.ReadPointer(pointerOffset);
 }
 
 //Convert number into hex format string
@@ -112,10 +105,22 @@ QString HWordToPermutedString(quint16 hword)
 
 bool IsROMFile()
 {
-    if (romFile.size() == (8 << 20) ||
-            romFile.size() == (16 << 20) ||
-            romFile.size() == (32 << 20))
+    if (rom.Size() == (8 << 20) ||
+            rom.Size() == (16 << 20) ||
+            rom.Size() == (32 << 20))
         return true;
     else
         return false;
 }
+
+//Replaces dest if it exists (QFile::rename doesn't), atomic on POSIX
+bool RenameFileOver(QString source, QString dest)
+{
+#ifdef Q_OS_WIN
+    return MoveFileExW(reinterpret_cast<const wchar_t*>(QDir::toNativeSeparators(source).utf16()),
+                       reinterpret_cast<const wchar_t*>(QDir::toNativeSeparators(dest).utf16()),
+                       MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    return std::rename(QFile::encodeName(source).constData(), QFile::encodeName(dest).constData()) == 0;
+#endif
+}
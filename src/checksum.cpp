@@ -0,0 +1,228 @@
+#include "include/checksum.h"
+#include <QVector>
+#include <QtEndian>
+#include <QtConcurrent>
+
+#define CRC32_POLYNOMIAL 0xEDB88320
+
+struct Crc32Chunk {
+    const uchar *data;
+    quint32 length;
+    quint32 crc;
+};
+
+static const quint32 *Crc32Tables();
+static void Crc32ChunkWorker(Crc32Chunk &chunk);
+static quint32 Gf2MatrixTimes(const quint32 *mat, quint32 vec);
+static void Gf2MatrixSquare(quint32 *square, const quint32 *mat);
+static quint64 Rotl64(quint64 x, int r);
+static quint64 Fmix64(quint64 k);
+
+//Standard CRC-32 (zlib), continues from a previous crc.
+//Slicing-by-8: eight table lookups per 8 input bytes
+quint32 Crc32(const uchar *data, quint32 length, quint32 crc)
+{
+    const quint32 *table = Crc32Tables();
+    quint32 c = ~crc;
+
+    while (length >= 8)
+    {
+        quint32 lo = c ^ (data[0] | (data[1] << 8) | (data[2] << 16) | (static_cast<quint32>(data[3]) << 24));
+        quint32 hi = data[4] | (data[5] << 8) | (data[6] << 16) | (static_cast<quint32>(data[7]) << 24);
+
+        c = table[7 * 256 + (lo & 0xFF)] ^ table[6 * 256 + ((lo >> 8) & 0xFF)] ^
+                table[5 * 256 + ((lo >> 16) & 0xFF)] ^ table[4 * 256 + (lo >> 24)] ^
+                table[3 * 256 + (hi & 0xFF)] ^ table[2 * 256 + ((hi >> 8) & 0xFF)] ^
+                table[1 * 256 + ((hi >> 16) & 0xFF)] ^ table[hi >> 24];
+        data += 8;
+        length -= 8;
+    }
+
+    while (length--)
+        c = table[(c ^ *data++) & 0xFF] ^ (c >> 8);
+
+    return ~c;
+}
+
+//CRC of two concatenated blocks from the CRC of each one (zlib's crc32_combine)
+quint32 Crc32Combine(quint32 crc1, quint32 crc2, quint32 length2)
+{
+    quint32 even[32];
+    quint32 odd[32];
+    quint32 row = 1;
+
+    if (length2 == 0)
+        return crc1;
+
+    //Operator for one zero bit
+    odd[0] = CRC32_POLYNOMIAL;
+    for (int n = 1; n < 32; n++)
+    {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    Gf2MatrixSquare(even, odd);     //Two zero bits
+    Gf2MatrixSquare(odd, even);     //Four zero bits
+
+    //Applies length2 zero bytes to crc1
+    do
+    {
+        Gf2MatrixSquare(even, odd);
+        if (length2 & 1)
+            crc1 = Gf2MatrixTimes(even, crc1);
+        length2 >>= 1;
+
+        if (length2 == 0)
+            break;
+
+        Gf2MatrixSquare(odd, even);
+        if (length2 & 1)
+            crc1 = Gf2MatrixTimes(odd, crc1);
+        length2 >>= 1;
+    } while (length2 != 0);
+
+    return crc1 ^ crc2;
+}
+
+//CRC-32 of a large buffer, every chunk is hashed in parallel and then combined
+quint32 ParallelCrc32(const uchar *data, quint32 length)
+{
+    QVector<Crc32Chunk> chunks;
+    quint32 crc = 0;
+
+    for (quint32 pos = 0; pos < length; pos += CRC32_CHUNK_SIZE)
+    {
+        Crc32Chunk chunk = {data + pos, qMin<quint32>(CRC32_CHUNK_SIZE, length - pos), 0};
+        chunks.append(chunk);
+    }
+
+    QtConcurrent::blockingMap(chunks, Crc32ChunkWorker);
+
+    for (int i=0; i<chunks.size(); i++)
+        crc = Crc32Combine(crc, chunks[i].crc, chunks[i].length);
+
+    return crc;
+}
+
+//MurmurHash3 x64 128-bit (public domain, Austin Appleby), used to find identical
+//samples. Not cryptographic, equal hashes still need a full compare
+Hash128 Murmur3Hash128(const uchar *data, quint32 length, quint32 seed)
+{
+    const quint64 c1 = Q_UINT64_C(0x87c37b91114253d5);
+    const quint64 c2 = Q_UINT64_C(0x4cf5ad432745937f);
+    quint32 blocks = length / 16;
+    quint64 h1 = seed;
+    quint64 h2 = seed;
+    quint64 k1, k2;
+
+    for (quint32 i = 0; i < blocks; i++)
+    {
+        k1 = qFromLittleEndian<quint64>(data + i * 16);
+        k2 = qFromLittleEndian<quint64>(data + i * 16 + 8);
+
+        k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = Rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = Rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    //Tail, up to 15 bytes
+    const uchar *tail = data + blocks * 16;
+    quint32 rest = length & 15;
+    k1 = 0;
+    k2 = 0;
+
+    for (quint32 i = rest; i > 8; i--)
+        k2 ^= static_cast<quint64>(tail[i - 1]) << ((i - 9) * 8);
+    if (rest > 8)
+    {
+        k2 *= c2; k2 = Rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+
+    for (quint32 i = qMin<quint32>(rest, 8); i > 0; i--)
+        k1 ^= static_cast<quint64>(tail[i - 1]) << ((i - 1) * 8);
+    if (rest > 0)
+    {
+        k1 *= c1; k1 = Rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= length;
+    h2 ^= length;
+    h1 += h2;
+    h2 += h1;
+    h1 = Fmix64(h1);
+    h2 = Fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    Hash128 hash = {h1, h2};
+    return hash;
+}
+
+static void Crc32ChunkWorker(Crc32Chunk &chunk)
+{
+    chunk.crc = Crc32(chunk.data, chunk.length);
+}
+
+//Lookup tables for slicing-by-8, built on first use
+static const quint32 *Crc32Tables()
+{
+    static const QVector<quint32> tables = [] {
+        QVector<quint32> t(8 * 256);
+
+        for (quint32 i = 0; i < 256; i++)
+        {
+            quint32 c = i;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? (c >> 1) ^ CRC32_POLYNOMIAL : c >> 1;
+            t[i] = c;
+        }
+
+        for (quint32 i = 0; i < 256; i++)
+            for (int slice = 1; slice < 8; slice++)
+                t[slice * 256 + i] = (t[(slice - 1) * 256 + i] >> 8) ^ t[t[(slice - 1) * 256 + i] & 0xFF];
+
+        return t;
+    }();
+
+    return tables.constData();
+}
+
+static quint32 Gf2MatrixTimes(const quint32 *mat, quint32 vec)
+{
+    quint32 sum = 0;
+
+    while (vec)
+    {
+        if (vec & 1)
+            sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+
+    return sum;
+}
+
+static void Gf2MatrixSquare(quint32 *square, const quint32 *mat)
+{
+    for (int n = 0; n < 32; n++)
+        square[n] = Gf2MatrixTimes(mat, mat[n]);
+}
+
+static quint64 Rotl64(quint64 x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static quint64 Fmix64(quint64 k)
+{
+    k ^= k >> 33;
+    k *= Q_UINT64_C(0xff51afd7ed558ccd);
+    k ^= k >> 33;
+    k *= Q_UINT64_C(0xc4ceb9fe1a85ec53);
+    k ^= k >> 33;
+
+    return k;
+}
@@ -0,0 +1,242 @@
+#include "include/cli.h"
+#include "include/binary_utils.h"
+#include "include/gba_music_utils.h"
+#include "include/m4a_sequence.h"
+#include "include/pret_utils.h"
+#include "include/rom_profiles.h"
+#include "include/sample_cache.h"
+#include "include/song_table_locator.h"
+#include "include/globals.h"
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+static int Fail(int code, QString msg);
+
+//--rom or a help option select the headless mode. Anything else is left to the
+//GUI, Qt's own options (-style, -platform) and the macOS -psn_ argument included
+bool IsCommandLineInvocation(int argc, char *argv[])
+{
+    static const char *options[] = {"--rom", "-h", "--help", "-?", "--help-all"};
+
+    for (int i=1; i<argc; i++)
+    {
+        QByteArray arg(argv[i]);
+
+        if (arg.startsWith("--rom="))
+            return true;
+
+        for (size_t j=0; j<sizeof(options) / sizeof(options[0]); j++)
+            if (arg == options[j])
+                return true;
+    }
+    return false;
+}
+
+//Headless extraction, no widgets are created so it runs without a display.
+//gba2pmd --rom game.gba --pret pokeemerald --output music_data [--first 1 --last 50]
+int RunCommandLine(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCommandLineParser parser;
+    QTextStream out(stdout);
+    QElapsedTimer timer;
+    bool unkownROM;
+    bool ok;
+
+    QCommandLineOption romOption("rom", "GBA ROM file to extract the music from.", "file");
+    QCommandLineOption pretOption("pret", "Pret project the data is extracted for.", "folder");
+    QCommandLineOption outputOption("output", "Folder the music data is written to.", "folder");
+    QCommandLineOption firstOption("first", "First song table entry to extract (default 1).", "entry", "1");
+    QCommandLineOption lastOption("last", "Last song table entry to extract (default: last song).", "entry");
+    QCommandLineOption songTableOption("song-table", "Song table offset (hex) for unknown ROMs, "
+                                       "located automatically if not given.", "offset");
+    QCommandLineOption profilesOption("profiles", "ROM profile file to load.", "file");
+    QCommandLineOption manualNamesOption("manual-names", "Don't name songs automatically.");
+    QCommandLineOption overrideOption("override-pret", "Override the pret project data.");
+    QCommandLineOption sampleWorkersOption("sample-workers", "Threads converting samples (default: one per core).",
+                                           "threads", "0");
+    QCommandLineOption sampleFormatOption("sample-format", "DirectSound sample files: aif, bin (copied from "
+                                          "the ROM, no conversion) or wav (default aif).", "format", "aif");
+    QCommandLineOption sampleRateOption("sample-rate", "Resample every DirectSound sample to this rate in Hz "
+                                        "(default: keep each sample's own rate).", "Hz", "0");
+    QCommandLineOption nearDuplicatesOption("near-duplicates", "Look for DirectSound samples that differ only "
+                                            "in padding, loop point or a few bytes: report or merge them.", "mode");
+    QCommandLineOption songFormatOption("song-format", "Songs: midi (mus_N.mid built by mid2agb) or asm "
+                                        "(mus_N.s disassembled from the ROM, default midi).", "format", "midi");
+    QCommandLineOption sampleCacheOption("sample-cache", "Folder converted samples are cached in across runs.",
+                                         "folder", DefaultSampleCachePath());
+    QCommandLineOption sampleCacheSizeOption("sample-cache-size", "Sample cache size limit in MiB (default " +
+                                             QString::number(SAMPLE_CACHE_DEFAULT_SIZE_MB) + ").", "MiB",
+                                             QString::number(SAMPLE_CACHE_DEFAULT_SIZE_MB));
+    QCommandLineOption noSampleCacheOption("no-sample-cache", "Convert every sample, don't use the sample cache.");
+    QCommandLineOption renderOption("render", "Also render every extracted song to a WAV file in this folder "
+                                    "(DirectSound voices only).", "folder");
+
+    parser.setApplicationDescription("GBA to PRET Music Data");
+    parser.addHelpOption();
+    parser.addOptions({romOption, pretOption, outputOption, firstOption, lastOption,
+                       songTableOption, profilesOption, manualNamesOption, overrideOption,
+                       sampleWorkersOption, sampleFormatOption, sampleRateOption, nearDuplicatesOption, songFormatOption, sampleCacheOption, sampleCacheSizeOption, noSampleCacheOption, renderOption});
+    parser.process(app);
+
+    if (!parser.isSet(romOption) || !parser.isSet(pretOption) || !parser.isSet(outputOption))
+        return Fail(CLI_EXIT_USAGE, "--rom, --pret and --output are required");
+
+    timer.start();
+
+    if (parser.isSet(profilesOption))
+    {
+        if (!LoadRomProfiles(parser.value(profilesOption)))
+            return Fail(CLI_EXIT_USAGE, "Can't load ROM profiles \"" + parser.value(profilesOption) + "\"");
+    }
+    else
+        LoadRomProfiles(QCoreApplication::applicationDirPath() + "/" + ROM_PROFILES_FILE);
+
+    //ROM
+    if (!InitROMFile(parser.value(romOption)) || !IsROMFile())
+        return Fail(CLI_EXIT_ROM, "\"" + parser.value(romOption) + "\" is not a ROM");
+
+    unkownROM = !CheckRomVersion();
+
+    if (unkownROM)
+    {
+        if (parser.isSet(songTableOption))
+        {
+            romSongTableOffset = parser.value(songTableOption).toUInt(&ok, 16);
+            if (!ok)
+                return Fail(CLI_EXIT_USAGE, "Bad song table offset \"" + parser.value(songTableOption) + "\"");
+        }
+        else
+        {
+            QList<SongTableCandidate> candidates = LocateSongTables();
+
+            if (candidates.isEmpty())
+                return Fail(CLI_EXIT_ROM, "Unkown ROM and no song table found, use --song-table");
+            romSongTableOffset = candidates.first().offset;
+        }
+    }
+    InitROMData(unkownROM);
+
+    //Pret
+    pretPath = parser.value(pretOption);
+    pretReady = InitPretRepoData();
+
+    if (!pretReady)
+        return Fail(CLI_EXIT_PRET, "\"" + pretPath + "\" is not a pret project");
+
+    //Configuration
+    OUTPUT_DIRECTORY = parser.value(outputOption);
+    automaticSongNames = !parser.isSet(manualNamesOption);
+    overridePret = parser.isSet(overrideOption);
+
+    sampleWorkers = parser.value(sampleWorkersOption).toInt(&ok);
+    if (!ok || sampleWorkers < 0)
+        return Fail(CLI_EXIT_USAGE, "Bad sample worker count \"" + parser.value(sampleWorkersOption) + "\"");
+
+    QStringList sampleFormats = {"aif", "bin", "wav"};  //Same order as SAMPLE_FORMAT_*
+    if (!sampleFormats.contains(parser.value(sampleFormatOption)))
+        return Fail(CLI_EXIT_USAGE, "Bad sample format \"" + parser.value(sampleFormatOption) + "\"");
+    sampleFormat = sampleFormats.indexOf(parser.value(sampleFormatOption));
+
+    //The m4a header stores rate * 1024 in 32 bits
+    sampleRate = parser.value(sampleRateOption).toUInt(&ok);
+    if (!ok || sampleRate > 0x3FFFFF)
+        return Fail(CLI_EXIT_USAGE, "Bad sample rate \"" + parser.value(sampleRateOption) + "\"");
+
+    if (parser.isSet(nearDuplicatesOption))
+    {
+        if (parser.value(nearDuplicatesOption) == "report")
+            nearDuplicateMode = NEAR_DUPLICATES_REPORT;
+        else if (parser.value(nearDuplicatesOption) == "merge")
+            nearDuplicateMode = NEAR_DUPLICATES_MERGE;
+        else
+            return Fail(CLI_EXIT_USAGE, "Bad near-duplicate mode \"" + parser.value(nearDuplicatesOption) + "\"");
+    }
+
+    QStringList songFormats = {"midi", "asm"};          //Same order as SONG_FORMAT_*
+    if (!songFormats.contains(parser.value(songFormatOption)))
+        return Fail(CLI_EXIT_USAGE, "Bad song format \"" + parser.value(songFormatOption) + "\"");
+    songFormat = songFormats.indexOf(parser.value(songFormatOption));
+
+    qint64 sampleCacheSize = parser.value(sampleCacheSizeOption).toLongLong(&ok);
+    if (!ok || sampleCacheSize < 0)
+        return Fail(CLI_EXIT_USAGE, "Bad sample cache size \"" + parser.value(sampleCacheSizeOption) + "\"");
+
+    //A cache that can't be created only costs time, the extraction still runs
+    if (!parser.isSet(noSampleCacheOption))
+        InitSampleCache(parser.value(sampleCacheOption), sampleCacheSize * 1024 * 1024);
+
+    //romSongTableSize is the last entry, entry 0 is never extracted
+    if (romSongTableSize == 0 || romSongTableSize > SONG_TABLE_MAX_ENTRY)
+        return Fail(CLI_EXIT_ROM, "The song table at 0x" + IntToHexQString(romSongTableOffset) + " has no songs");
+
+    quint32 first = parser.value(firstOption).toUInt(&ok);
+    if (!ok)
+        return Fail(CLI_EXIT_USAGE, "Bad first song \"" + parser.value(firstOption) + "\"");
+
+    quint32 last = parser.isSet(lastOption) ? parser.value(lastOption).toUInt(&ok) : romSongTableSize;
+    if (!ok)
+        return Fail(CLI_EXIT_USAGE, "Bad last song \"" + parser.value(lastOption) + "\"");
+
+    if (first < 1 || first > last || last > romSongTableSize)
+        return Fail(CLI_EXIT_USAGE, "Song range must be within 1-" + IntToDecimalQString(romSongTableSize));
+
+    minSong = first;
+    maxSong = last;
+
+    if (ExtractROMSongData(minSong, maxSong, nullptr, nullptr) != EXTRACTION_SUCCESS)
+        return Fail(CLI_EXIT_EXTRACTION, "Some files couldn't be written at \"" + OUTPUT_DIRECTORY + "\"");
+
+    out << "ROM: " << (unkownROM ? QString("UNKR - Unkown ROM") : romProfile->code + " - " + romProfile->name)
+        << " (song table 0x" << IntToHexQString(romSongTableOffset) << ")\n";
+    out << "Extracted songs " << minSong << "-" << maxSong << " to \"" << OUTPUT_DIRECTORY
+        << "\" in " << timer.elapsed() << " ms\n";
+
+    if (nearDuplicateMode != NEAR_DUPLICATES_OFF)
+    {
+        QList<QList<quint32> > groups = NearDuplicateSamples();
+
+        out << "Near-duplicate samples: " << groups.size() << " groups"
+            << (nearDuplicateMode == NEAR_DUPLICATES_MERGE ? " (merged)" : "") << "\n";
+        for (int i=0; i<groups.size(); i++)
+        {
+            out << "\t";
+            for (int j=0; j<groups[i].size(); j++)
+                out << (j > 0 ? ", " : "") << "DirectSoundWaveData_" << IntToHexQString(groups[i][j]);
+            out << "\n";
+        }
+    }
+
+    SequenceCacheStats blocks = GetSequenceCacheStats();
+    out << "Track blocks: " << blocks.decoded << " decoded, " << blocks.reused << " reused\n";
+
+    if (IsSampleCacheEnabled())
+    {
+        SampleCacheStats stats = GetSampleCacheStats();
+
+        out << "Sample cache: " << stats.hits << " hits, " << stats.misses << " misses, "
+            << stats.evicted << " evicted\n";
+    }
+
+    if (parser.isSet(renderOption))
+    {
+        QElapsedTimer renderTimer;
+
+        renderTimer.start();
+        if (!RenderSongs(parser.value(renderOption)))
+            return Fail(CLI_EXIT_EXTRACTION, "Some songs couldn't be rendered at \"" + parser.value(renderOption) + "\"");
+        out << "Rendered songs to \"" << parser.value(renderOption) << "\" in " << renderTimer.elapsed() << " ms\n";
+    }
+
+    return CLI_EXIT_OK;
+}
+
+static int Fail(int code, QString msg)
+{
+    QTextStream err(stderr);
+
+    err << "gba2pmd: " << msg << "\n";
+    return code;
+}
@@ -0,0 +1,38 @@
+#include "include/extraction_worker.h"
+#include "include/gba_music_utils.h"
+
+ExtractionWorker::ExtractionWorker(quint16 min, quint16 max, QObject *parent)
+    : QObject(parent)
+    , minSong(min)
+    , maxSong(max)
+    , cancelled(0)
+{
+}
+
+//Thread safe, the extraction stops before the next song or sample
+void ExtractionWorker::Cancel()
+{
+    cancelled.storeRelease(1);
+}
+
+void ExtractionWorker::Run()
+{
+    quint8 result;
+
+    progressTimer.start();
+    result = ExtractROMSongData(minSong, maxSong,
+                                [this](quint8 percentage) { ReportProgress(percentage); },
+                                [this]() { return cancelled.loadAcquire() != 0; });
+
+    emit Finished(result);
+}
+
+//Progress signals are queued to the GUI thread, so they are limited to ~30 Hz
+void ExtractionWorker::ReportProgress(quint8 percentage)
+{
+    if (percentage < 100 && progressTimer.elapsed() < PROGRESS_INTERVAL_MS)
+        return;
+
+    progressTimer.restart();
+    emit Progress(percentage);
+}
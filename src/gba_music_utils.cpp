@@ -1,26 +1,73 @@
 #include "include/aif2pcm/aif2pcm.h"
 #include "include/gba_music_utils.h"
 #include "include/binary_utils.h"
+#include "include/checksum.h"
 #include "include/globals.h"
+#include "include/m4a_disassembler.h"
+#include "include/m4a_sequence.h"
+#include "include/midi_writer.h"
+#include "include/offset_index.h"
+#include "include/resampler.h"
+#include "include/rom_profiles.h"
+#include "include/sample_similarity.h"
+#include "include/sample_cache.h"
+#include "include/song_renderer.h"
 #include <QTextStream>
 #include <QList>
+#include <QHash>
 #include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QMutex>
+#include <QThreadPool>
+#include <QtConcurrent>
+
+enum {ITEM_VOICEGROUP, ITEM_KEYSPLIT, ITEM_SAMPLE, ITEM_PWSAMPLE};
+
+struct SongItem {
+    quint8 type;
+    quint32 offset;
+};
+
+//A song parsed on its own, without touching the global lists.
+//items keeps the first appearance of everything the song uses in parsing
+//order, so merging songs in table order gives the same ids as a serial run
+struct ParsedSong {
+    Song song;
+    SongHeader header;
+    bool hasHeader;
+    SongSequence sequence;
+    bool hasSequence;
+    SongListing listing;
+    bool hasListing;
+    QList<SongItem> items;
+    OffsetIndex<VoiceGroup> voiceGroups;
+    OffsetIndex<QString> voiceErrors;
+    OffsetIndex<QStringList> keySplits;
+    OffsetSet samples;
+    OffsetSet pwSamples;
+};
 
 /** Data Init **/
 static void InitROMSongTableOffset();
 static void InitROMSongTableEntries();
 /** Parsers **/ //Parse music related data
-static void ParseSong(quint16 pos);
-static void ParseSongHeader(Song song);
-static void ParseVoiceGroup(quint32 vgOffset);
-static QString ParseVGEntry(quint32 vgeOffset);
-static QString ParseDirectSound(Instrument ins, quint8 mode);
-static QString ParseVoiceSquare_1(Instrument ins, quint8 mode);
-static QString ParseReadVoiceSquare_2(Instrument ins, quint8 mode);
-static QString ParseProgrammableWave(Instrument ins, quint8 mode);
-static QString ParseVoiceNoise(Instrument ins, quint8 mode);
-static QString ParseKeysplit(Instrument ins, quint8 mode);
-static void ParseSplit(quint32 offset);
+static ParsedSong ParseSong(quint16 pos);
+static void ParseSongHeader(ParsedSong &ps);
+static void ParseVoiceGroup(ParsedSong &ps, quint32 vgOffset);
+static Instrument ParseVGEntry(ParsedSong &ps, quint32 vgeOffset);
+static void ParseDirectSound(ParsedSong &ps, Instrument ins);
+static void ParseProgrammableWave(ParsedSong &ps, Instrument ins);
+static void ParseKeysplit(ParsedSong &ps, Instrument ins, quint8 mode);
+static void ParseSplit(ParsedSong &ps, quint32 offset);
+/** Merge **/ //Adds the parsed songs to the global lists
+static void MergeParsedSong(ParsedSong &ps);
+/** Decoders **/ //Fields of the raw ToneData
+static DirectSound DecodeDirectSound(Instrument ins);
+static SquareSound DecodeSquareSound(Instrument ins);
+static ProgramableWave DecodeProgramableWave(Instrument ins);
+static VoiceNoise DecodeVoiceNoise(Instrument ins);
+static VoiceKeysplit DecodeVoiceKeysplit(Instrument ins, quint8 mode);
 /** Create File Entries **/
 static void CreateSongTableEntry(struct Song song);
 static void CreateSongConstantEntry(struct Song song);
@@ -30,37 +77,87 @@ static QString CreateSquareSound2Entry(SquareSound ss, quint8 mode);
 static QString CreateProgramableWaveEntry(ProgramableWave pw, quint8 mode);
 static QString CreateVoiceNoise(VoiceNoise vn, quint8 mode);
 static QString CreateVoiceKeysplit(VoiceKeysplit vk, quint8 mode);
+static QString CreateVoiceEntry(const VoiceGroup &vg, int slot);
 static void CreateSongMKEntry(struct Song song, struct SongHeader header);
+static void CreateLdScriptEntry(struct Song song, bool assembled);
 /** Build Files **/ //Build the different music related files
-static void BuildSongTableFile();
-static void BuildSongConstantsFile();
-static void BuildVoiceGroupFile(quint32 vgOffset);
-static void BuildVoiceGroupsTable();
-static void BuildKeySplitFile();
-static void BuildDirectSoundDataFile();
-static void BuildProgrammableWaveDataFile();
-static void BuildLd_ScriptFile();
-static void BuildSongsMKFile();
-static void BuildTempSampleBinary(quint32 sample);
-static void BuildAifSampleFile(QString path);
-static void DeleteTempBinarySampleFiles();
-static void BuildPcmSampleFile(quint32 pcm);
+static bool BuildSongTableFile();
+static bool BuildSongConstantsFile();
+static bool BuildVoiceGroupFile(quint32 vgOffset);
+static bool BuildVoiceGroupsTable();
+static bool BuildKeySplitFile();
+static bool BuildDirectSoundDataFile();
+static bool BuildProgrammableWaveDataFile();
+static bool BuildLd_ScriptFile();
+static bool BuildSongsMKFile();
+static bool BuildDirectSoundSampleFile(int index);
+static bool BuildPcmSampleFile(quint32 pcm);
+static bool BuildMidiFile(Song song);
+static bool BuildAsmFile(Song song);
+/** Song Rendering **/ //Voicegroups as the renderer plays them
+static RenderVoiceGroup BuildRenderVoiceGroup(quint32 vgOffset);
+static RenderInstrument BuildRenderInstrument(Instrument ins);
+static RenderVoice BuildRenderVoice(Instrument ins);
+static RenderVoice BuildRenderSample(quint32 sample);
+static bool RenderSongFile(Song song, QString folder);
 /** Utils **/
 static void CreatePaths();
 static void CreatePath(QString path);
-static void RenameKeysplitSVGPointers();
-static void RenameKeysplitPointers();
+static bool PublishStagedFiles(QString stagingPath, QString path);
+static int DeduplicateSamples();
+static int FindNearDuplicateSamples();
+static SampleFingerprint FingerprintSample(int index);
+static quint32 SampleSource(quint32 sample);
+static SampleHeader ReadSampleHeader(quint32 sample);
+static RomSpan ReadSampleSpan(quint32 sample);
+static QByteArray ResampleSample(quint32 sample, RomSpan data);
+static bool IsCancelled();
+static void StartProgressPhase(quint8 base, quint8 span, quint32 steps);
+static void ReportProgress();
+static quint16 VoiceGroupId(quint32 vgOffset);
+static QString VoiceGroupNumber(quint32 vgOffset);
+static quint16 KeysplitId(quint32 ksOffset);
 
 static QStringList songTable_list;             //sound/song_table.inc
 static QStringList songConstants_list;         //include/constants/songs.h
-static QMap<quint32, QStringList> voiceGroups_map; //sound/voice_groups.inc
-static QMap<quint32, QStringList> keySplit_map;    //sound/keysplit_tables.inc
-static QList<quint32> sample_list;                 //sound/direct_sound_samples/XXX.aif
-static QList<quint32> pwSample_list;               //sound/programmable_wave_samples/XXX.pcm
-static QMap<quint32, quint16> vgIds_map;       //Contains id's of each map
-static QMap<quint16, quint32> ksplitIds_map;
+//Ids are the dense index in each of them, see VoiceGroupId and KeysplitId
+static OffsetIndex<VoiceGroup> voiceGroups;    //sound/voice_groups.inc
+static OffsetIndex<QString> voiceErrors;       //Placeholder messages by entry offset
+static OffsetIndex<QStringList> keySplits;     //sound/keysplit_tables.inc
+static OffsetSet samples;                      //sound/direct_sound_samples/XXX.aif (or .bin, .wav)
+static QVector<int> sampleSources;             //Index of the first sample with the same content
+static QVector<Hash128> sampleHashes;          //Content hash of each sample, keys the sample cache
+static QList<QList<quint32> > nearDuplicates;  //Similar sample offsets, the kept one first
+static OffsetSet pwSamples;                    //sound/programmable_wave_samples/XXX.pcm
+static OffsetIndex<SongSequence> sequences;    //Decoded tracks by song header
+static QList<Song> midiSongs;                  //sound/songs/midi/mus_N.mid
+static OffsetIndex<SongListing> listings;      //Disassembled tracks by song header
+static QList<Song> asmSongs;                   //sound/songs/mus_N.s
+static OffsetIndex<RenderVoiceGroup> renderGroups;  //Voicegroups of the rendered songs
+static OffsetIndex<RenderVoice> renderSamples;      //Decoded DirectSound samples, no envelope
 static QStringList songMK_list;                //songs.mk
 static QStringList ld_scripts_list;    //@song_data ld_script.txt
+static CancelCallback cancelRequested;
+static ProgressCallback progressReport;
+static QMutex progressMutex;
+static quint32 progressDone;
+static quint32 progressTotal;
+static quint8 progressBase;
+static quint8 progressSpan;
+
+//Writers of DirectSound sample files by sampleFormat, they all take the
+//sample straight from the ROM (header + data)
+struct SampleSink {
+    QString extension;
+    bool (*write)(const uint8_t *data, unsigned long length, const char *path, uint32_t baseNote);
+    bool cached;            //Passthrough is as fast as a cache hit
+};
+
+static const SampleSink sampleSinks[] = {
+    {AIF_EXTENSION, pcm2aif_buffer, true},
+    {BIN_EXTENSION, pcm2bin_buffer, false},
+    {WAV_EXTENSION, pcm2wav_buffer, true},
+};
 
 //Initialize ROM Data
 void InitROMData(bool unkownRom)
@@ -73,7 +170,7 @@ void InitROMData(bool unkownRom)
 //Search song's table
 static void InitROMSongTableOffset()
 {
-    romSongTableOffset = ResolveROMHexPointer(ROM_SONG_TABLE_POINTERS[romType]);
+    romSongTableOffset = ResolveROMHexPointer(romProfile->songTablePointer);
 }
 
 //Initialize the ammount of song entries in the song table
@@ -82,153 +179,209 @@ static void InitROMSongTableEntries()
     romSongTableSize = -1;
 
     for(int i=0;; i += SONG_TABLE_PADDING, romSongTableSize++)
-        if (ReadROMWordAt(romSongTableOffset + i) == 0 || romSongTableSize == 999)
+        if (!rom.Contains(romSongTableOffset + i, SONG_TABLE_PADDING) ||
+                rom.ReadWord(romSongTableOffset + i) == 0 || romSongTableSize == SONG_TABLE_MAX_ENTRY)
             break;
 }
 
-//Starts extraction of music data from ROM between min and max entries of the song table
-void ExtractROMSongData(quint16 min, quint16 max, MainWindow* mw)
+//Starts extraction of music data from ROM between min and max entries of the song table.
+//Files are written to a staging folder and only moved to OUTPUT_DIRECTORY once
+//the whole extraction succeeded, a cancelled run leaves no output behind
+quint8 ExtractROMSongData(quint16 min, quint16 max, ProgressCallback progress, CancelCallback cancelled)
 {
+    QString outputDirectory = OUTPUT_DIRECTORY;
+    quint8 result;
+
     songTable_list.clear();
     songConstants_list.clear();
-    voiceGroups_map.clear();
-    keySplit_map.clear();
-    sample_list.clear();
-    pwSample_list.clear();
-    vgIds_map.clear();
-    ksplitIds_map.clear();
+    voiceGroups.Clear();
+    voiceErrors.Clear();
+    keySplits.Clear();
+    samples.Clear();
+    sampleSources.clear();
+    sampleHashes.clear();
+    nearDuplicates.clear();
+    pwSamples.Clear();
+    sequences.Clear();
+    midiSongs.clear();
+    listings.Clear();
+    asmSongs.clear();
     songMK_list.clear();
     ld_scripts_list.clear();
+    cancelRequested = cancelled;
+    progressReport = progress;
+    ResetSampleCacheStats();
+    ClearSequenceCache();
+    ResetSequenceCacheStats();
 
-    quint16 entries = max - min;
+    OUTPUT_DIRECTORY = outputDirectory + STAGING_SUFFIX;
+    QDir(OUTPUT_DIRECTORY).removeRecursively();
 
-    for (int i=0; i<=entries; i++)
-    {
-        ParseSong(min + i);
+    //The GUI and the CLI check the range, entries past the table aren't songs
+    QList<quint16> positions;
+    for (quint32 i=min; i<=qMin<quint32>(max, romSongTableSize); i++)
+        positions.append(i);
+
+    //Songs are the first half of the progress, samples the second one
+    StartProgressPhase(0, 50, positions.size() * 2);
+
+    //Every song is parsed on its own in parallel, then merged in song table order
+    QList<ParsedSong> songs = QtConcurrent::blockingMapped<QList<ParsedSong> >(positions, ParseSong);
+    ClearSequenceCache();     //Only parsing decodes tracks
 
-        mw->SetPercentage((i+1) * 100 / (entries + 1));
+    for (int i=0; i<songs.size() && !IsCancelled(); i++)
+    {
+        MergeParsedSong(songs[i]);
+        ReportProgress();
     }
 
-    BuildSongFiles();
+    if (IsCancelled())
+        result = EXTRACTION_CANCELLED;
+    else if (!BuildSongFiles() && !IsCancelled())
+        result = EXTRACTION_FAILED;
+    else if (IsCancelled())     //Samples skipped after a cancel aren't a failure
+        result = EXTRACTION_CANCELLED;
+    else if (!PublishStagedFiles(OUTPUT_DIRECTORY, outputDirectory))
+        result = EXTRACTION_FAILED;
+    else
+        result = EXTRACTION_SUCCESS;
+
+    QDir(OUTPUT_DIRECTORY).removeRecursively();
+    OUTPUT_DIRECTORY = outputDirectory;
+    TrimSampleCache();
+    cancelRequested = nullptr;
+    progressReport = nullptr;
+
+    return result;
 }
 
 /* ****************************** *
  * ***** Music Data Parsers ***** *
  * ****************************** */
 //Parses song data at the given position in the song table
-static void ParseSong(quint16 pos)
+static ParsedSong ParseSong(quint16 pos)
 {
-    Song song;
+    ParsedSong ps;
+
+    ps.hasHeader = false;
+    ps.hasSequence = false;
+    ps.hasListing = false;
+
+    if (IsCancelled())
+        return ps;
+
+    ps.song.headerPointer = 0;
+    ps.song.ms = 0;
+    ps.song.me = 0;
+
+    //Nothing may be thrown out of the parse tasks. A song whose table entry or
+    //header is out of the ROM keeps its table entry only
+    try {
+        RomSpan entry = rom.ReadSpan(romSongTableOffset + pos * SONG_TABLE_PADDING, SONG_TABLE_PADDING);
 
-    song.id = pretSongTableSize + 1 + songTable_list.size();
-    song.headerPointer = ResolveROMHexPointer(romSongTableOffset + pos * SONG_TABLE_PADDING);
-    song.ms = ReadROMHWordAt(romSongTableOffset + pos * SONG_TABLE_PADDING + SONG_MS_OFFSET);
-    song.me = ReadROMHWordAt(romSongTableOffset + pos * SONG_TABLE_PADDING + SONG_ME_OFFSET);
+        ps.song.headerPointer = entry.Pointer(0);
+        ps.song.ms = entry.HWord(SONG_MS_OFFSET);
+        ps.song.me = entry.HWord(SONG_ME_OFFSET);
 
-    CreateSongTableEntry(song);
-    CreateSongConstantEntry(song);
+        ParseSongHeader(ps);
+        ps.hasHeader = true;
+    } catch (QString) {}
+
+    //Songs that can't be disassembled still get a MIDI file
+    if (ps.hasHeader && songFormat == SONG_FORMAT_ASM)
+    {
+        try {
+            ps.listing = DisassembleSong(rom, ps.song.headerPointer);
+            ps.hasListing = true;
+        } catch (QString) {}
+    }
+
+    //Bad track data doesn't lose the rest of the song
+    if (ps.hasHeader && !ps.hasListing)
+    {
+        try {
+            ps.sequence = DecodeSongSequence(rom, ps.song.headerPointer);
+            ps.hasSequence = true;
+        } catch (QString) {}
+    }
 
-    ParseSongHeader(song);
+    ReportProgress();
+    return ps;
 }
 
 //Parses SongHeader
-static void ParseSongHeader(Song song)
+static void ParseSongHeader(ParsedSong &ps)
 {
-    SongHeader header;
+    RomSpan data = rom.ReadSpan(ps.song.headerPointer, SONG_HEADER_LENGTH);
 
-    header.priority = ReadROMByteAt(song.headerPointer + 2);
-    header.reverb = ReadROMByteAt(song.headerPointer + 3);
-    header.voiceGroupPointer = ResolveROMHexPointer(song.headerPointer + 4);
+    ps.header.tracks = data.Byte(0);
+    ps.header.blocks = data.Byte(1);
+    ps.header.priority = data.Byte(2);
+    ps.header.reverb = data.Byte(3);
+    ps.header.voiceGroupPointer = data.Pointer(4);
 
-    ParseVoiceGroup(header.voiceGroupPointer);
-    CreateSongMKEntry(song, header);
+    ParseVoiceGroup(ps, ps.header.voiceGroupPointer);
 }
 
 //Parses a VoiceGroup, either from songHeader or a keysplit
-static void ParseVoiceGroup(quint32 vgOffset)
+static void ParseVoiceGroup(ParsedSong &ps, quint32 vgOffset)
 {
-    QList<QString> voiceGroup_list;
+    VoiceGroup vg;
 
-    if (!voiceGroups_map.contains(vgOffset))
+    if (!ps.voiceGroups.Contains(vgOffset))
     {
         //Adds the id beforehand to avoid infinite looping
         //Just in case the voicegroup contains itself in a keysplit
-        vgIds_map.insert(vgOffset, pretvgTableSize + voiceGroups_map.size());
-        voiceGroups_map.insert(vgOffset, voiceGroup_list);
+        SongItem item = {ITEM_VOICEGROUP, vgOffset};
+        ps.items.append(item);
+        vg.offset = vgOffset;
+        int index = ps.voiceGroups.Insert(vgOffset, vg);
         for (int i=0; i<VG_SIZE; i++)
         {
-            voiceGroups_map[vgOffset].append(ParseVGEntry(vgOffset + VG_ENTRY_LENGTH * i));
+            Instrument ins = ParseVGEntry(ps, vgOffset + VG_ENTRY_LENGTH * i);
+            ps.voiceGroups.Value(index).instruments[i] = ins;
         }
     }
 }
 
-//Parses a VoiceGroup entry
-static QString ParseVGEntry(quint32 vgeOffset)
+//Parses a VoiceGroup entry, keeps its raw ToneData or a placeholder if it's invalid
+static Instrument ParseVGEntry(ParsedSong &ps, quint32 vgeOffset)
 {
-    QString entry;
-    Instrument ins;
-
-    ins.type = ReadROMByteAt(vgeOffset);
-
-    for (int i=0; i<11; i++)
-    {
-        ins.data[i] = ReadROMByteAt(vgeOffset + i + 1);
-    }
+    Instrument ins = {VOICE_PLACEHOLDER, {0}};
 
     try {
+        RomSpan data = rom.ReadSpan(vgeOffset, VG_ENTRY_LENGTH);
+
+        ins.type = data.Byte(0);
+        memcpy(ins.data, data.data + 1, sizeof(ins.data));
 
         switch (ins.type) {
 
             case DIRECT_SOUND:
-                entry = ParseDirectSound(ins, INSTRUMENT_NORMAL);
-                break;
-
             case DIRECT_SOUND_NO_R:
-                entry = ParseDirectSound(ins, INSTRUMENT_ALT);
-                break;
-
             case DIRECT_SOUND_ALT:
-                entry = ParseDirectSound(ins, INSTRUMENT_NO_RESAMPLE);
+                ParseDirectSound(ps, ins);
                 break;
 
             case VOICE_SQUARE_1:
-                entry = ParseVoiceSquare_1(ins, INSTRUMENT_NORMAL);
-                break;
-
             case VOICE_SQUARE_1_ALT:
-                entry = ParseVoiceSquare_1(ins, INSTRUMENT_ALT);
-                break;
-
             case VOICE_SQUARE_2:
-                entry = ParseReadVoiceSquare_2(ins, INSTRUMENT_NORMAL);
-                break;
-
             case VOICE_SQUARE_2_ALT:
-                entry = ParseReadVoiceSquare_2(ins, INSTRUMENT_ALT);
-                break;
+            case VOICE_NOISE:
+            case VOICE_NOISE_ALT:
+                break;  //Nothing outside the entry
 
             case VOICE_PROGRAMABLE_WAVE:
-                entry = ParseProgrammableWave(ins, INSTRUMENT_NORMAL);
-                break;
-
             case VOICE_PROGRAMABLE_WAVE_ALT:
-                entry = ParseProgrammableWave(ins, INSTRUMENT_ALT);
-                break;
-
-            case VOICE_NOISE:
-                entry = ParseVoiceNoise(ins, INSTRUMENT_NORMAL);
-                break;
-
-            case VOICE_NOISE_ALT:
-                entry = ParseVoiceNoise(ins, INSTRUMENT_ALT);
+                ParseProgrammableWave(ps, ins);
                 break;
 
             case VOICE_KEYSPLIT:
-                entry = ParseKeysplit(ins, INSTRUMENT_NORMAL);
+                ParseKeysplit(ps, ins, INSTRUMENT_NORMAL);
                 break;
 
             case VOICE_KEYSPLIT_ALL:
-                entry = ParseKeysplit(ins, INSTRUMENT_ALT);
+                ParseKeysplit(ps, ins, INSTRUMENT_ALT);
                 break;
 
             default:
@@ -236,154 +389,97 @@ static QString ParseVGEntry(quint32 vgeOffset)
                 throw msg;
         }
 
-        return entry;
-
     } catch(QString msg) {
-        return DEFAULT_VG_ENTRY + " \t\t@PLACEHOLDER: " + msg;
+        ins.type = VOICE_PLACEHOLDER;
+        ps.voiceErrors.Insert(vgeOffset, msg);
     }
+
+    return ins;
 }
 
 //Parses a DirectSound entry
-static QString ParseDirectSound(Instrument ins, quint8 mode)
+static void ParseDirectSound(ParsedSong &ps, Instrument ins)
 {
-    DirectSound dsound;
+    quint32 sample = qFromLittleEndian<quint32>(ins.data + 3);
 
-    dsound.sample = ((ins.data[6] << 24) + (ins.data[5] << 16) + (ins.data[4] << 8) + ins.data[3]); //& BINARY_POINTER_MASK;
-
-    if (dsound.sample < 0x8000000 || dsound.sample > 0x9FFFFFF)
+    if (sample < 0x8000000 || sample > 0x9FFFFFF)
     {
-        QString msg = "Bad sample pointer \"" + IntToHexQString(dsound.sample) + "\"";
+        QString msg = "Bad sample pointer \"" + IntToHexQString(sample) + "\"";
         throw msg;
     }
 
-    dsound.note = ins.data[0];
-    dsound.pan = ins.data[2];
-    dsound.sample &= BINARY_POINTER_MASK;
-    dsound.atk = ins.data[7];
-    dsound.dec = ins.data[8];
-    dsound.sus = ins.data[9];
-    dsound.rel = ins.data[10];
+    sample &= BINARY_POINTER_MASK;
 
-    if (!sample_list.contains(dsound.sample))
+    if (!ps.samples.Contains(sample))
     {
-        BuildTempSampleBinary(dsound.sample);
-        sample_list.append(dsound.sample);
-    }
-    return CreateDirectSoundEntry(dsound, mode);
-}
+        //Only checks the sample is readable, BuildSongFiles writes it
+        ReadSampleSpan(sample);
 
-//Parses a VoiceSquare_1 entry
-static QString ParseVoiceSquare_1(Instrument ins, quint8 mode)
-{
-    SquareSound ssound;
-
-    ssound.sweep = ins.data[2];
-    ssound.duty_cycle = ins.data[3];
-    ssound.atk = ins.data[7];
-    ssound.dec = ins.data[8];
-    ssound.sus = ins.data[9];
-    ssound.rel = ins.data[10];
-
-    return CreateSquareSound1Entry(ssound, mode);
-}
-
-//Parses a VoiceSquare_2 entry
-static QString ParseReadVoiceSquare_2(Instrument ins, quint8 mode)
-{
-    SquareSound ssound;
-
-    ssound.duty_cycle = ins.data[3];
-    ssound.atk = ins.data[7];
-    ssound.dec = ins.data[8];
-    ssound.sus = ins.data[9];
-    ssound.rel = ins.data[10];
-
-    return CreateSquareSound2Entry(ssound, mode);
+        SongItem item = {ITEM_SAMPLE, sample};
+        ps.items.append(item);
+        ps.samples.Insert(sample);
+    }
 }
 
 //Parses a ProgramableWave entry
-static QString ParseProgrammableWave(Instrument ins, quint8 mode)
+static void ParseProgrammableWave(ParsedSong &ps, Instrument ins)
 {
-    ProgramableWave pwave;
+    quint32 data = qFromLittleEndian<quint32>(ins.data + 3);
 
-    pwave.data = (ins.data[6] << 24) + (ins.data[5] << 16) + (ins.data[4] << 8) + ins.data[3];
-
-    if (pwave.data < 0x8000000 || pwave.data > 0x9FFFFFF)
+    if (data < 0x8000000 || data > 0x9FFFFFF)
     {
-        QString msg = "Bad programmable Wave pointer \"" + IntToHexQString(pwave.data) + "\"";
+        QString msg = "Bad programmable Wave pointer \"" + IntToHexQString(data) + "\"";
         throw msg;
     }
 
-    pwave.data &= BINARY_POINTER_MASK;
-    pwave.atk = ins.data[7];
-    pwave.dec = ins.data[8];
-    pwave.sus = ins.data[9];
-    pwave.rel = ins.data[10];
+    data &= BINARY_POINTER_MASK;
 
-    if (!pwSample_list.contains(pwave.data))
+    if (!ps.pwSamples.Contains(data))
     {
-        pwSample_list.append(pwave.data);
-        BuildPcmSampleFile(pwave.data);
-    }
-
-    return CreateProgramableWaveEntry(pwave, mode);
-}
-
-//Parses VoiceNoise entry
-static QString ParseVoiceNoise(Instrument ins, quint8 mode)
-{
-    VoiceNoise vnoise;
+        rom.ReadSpan(data, SAMPLE_HEADER_LENGTH);
 
-    vnoise.period = ins.data[3];
-    vnoise.atk = ins.data[7];
-    vnoise.dec = ins.data[8];
-    vnoise.sus = ins.data[9];
-    vnoise.rel = ins.data[10];
-
-    return CreateVoiceNoise(vnoise, mode);
+        SongItem item = {ITEM_PWSAMPLE, data};
+        ps.items.append(item);
+        ps.pwSamples.Insert(data);
+    }
 }
 
 //Parse Keysplit
-static QString ParseKeysplit(Instrument ins, quint8 mode)
+static void ParseKeysplit(ParsedSong &ps, Instrument ins, quint8 mode)
 {
-    VoiceKeysplit vksplit;
+    quint32 svg = qFromLittleEndian<quint32>(ins.data + 3);
 
-    vksplit.svg = ((ins.data[6] << 24) + (ins.data[5] << 0x10) + (ins.data[4] << 0x8) + ins.data[3]);
-
-    if (vksplit.svg < 0x8000000 || vksplit.svg > 0x9FFFFFF)
+    if (svg < 0x8000000 || svg > 0x9FFFFFF)
     {
-        QString msg = "Bad voiceGroup pointer \"" + IntToDecimalQString(vksplit.svg) + "\"";
+        QString msg = "Bad voiceGroup pointer \"" + IntToDecimalQString(svg) + "\"";
         throw msg;
     }
 
-    vksplit.svg &= BINARY_POINTER_MASK;
+    VoiceKeysplit vksplit = DecodeVoiceKeysplit(ins, mode);
 
-    if (mode == INSTRUMENT_NORMAL)
+    if (mode == INSTRUMENT_NORMAL && !ps.keySplits.Contains(vksplit.keysplit))
     {
-        vksplit.keysplit = ((ins.data[10] << 0x18) + (ins.data[9] << 0x10) + (ins.data[8] << 0x8) + ins.data[7]) & BINARY_POINTER_MASK;
-        if (!keySplit_map.contains(vksplit.keysplit))
-        {
-            ParseSplit(vksplit.keysplit);
-            ksplitIds_map.insert(pretKsTableSize + keySplit_map.size(), vksplit.keysplit);
-        }
-    }
+        ParseSplit(ps, vksplit.keysplit);
 
-    ParseVoiceGroup(vksplit.svg);
+        SongItem item = {ITEM_KEYSPLIT, vksplit.keysplit};
+        ps.items.append(item);
+    }
 
-    return CreateVoiceKeysplit(vksplit, mode);
+    ParseVoiceGroup(ps, vksplit.svg);
 }
 
 //Parse split from a keysplit_all
-static void ParseSplit(quint32 offset)
+static void ParseSplit(ParsedSong &ps, quint32 offset)
 {
     QStringList keySplit_list;
     quint8 backwardsOffset = 0;
     quint8 elements = 0;
+    RomSpan split = rom.ReadSpan(offset, KEYSPLIT_MAX_ELEMENTS);
 
     //Gets the backwards offset and the number of elements of the split
     for (int i=0; i < KEYSPLIT_MAX_ELEMENTS; i++)
     {
-        if (ReadROMByteAt(offset + i) == 0)
+        if (split.Byte(i) == 0)
         {
             backwardsOffset = i;
             elements = KEYSPLIT_MAX_ELEMENTS - backwardsOffset;
@@ -392,21 +488,155 @@ static void ParseSplit(quint32 offset)
     }
 
     //Reads the split
-    quint8 splitData[elements];
+    for (int i=0; i<elements; i++)
+    {
+        keySplit_list.append(IntToDecimalQString(split.Byte(i)));
+    }
 
-    for (int j=0; j<elements; j++)
+    ps.keySplits.Insert(offset, keySplit_list);
+}
+
+/* ****************************** *
+ * ******** Song Merging ******** *
+ * ****************************** */
+//Gives ids to everything new in the song. Called in song table order, so every
+//id matches what parsing the songs one by one would have assigned
+static void MergeParsedSong(ParsedSong &ps)
+{
+    ps.song.id = pretSongTableSize + 1 + songTable_list.size();
+
+    CreateSongTableEntry(ps.song);
+    CreateSongConstantEntry(ps.song);
+
+    for (int i=0; i<ps.items.size(); i++)
     {
-        splitData[j] = ReadROMByteAt(offset + j);
+        quint32 offset = ps.items[i].offset;
+
+        switch (ps.items[i].type)
+        {
+        case ITEM_VOICEGROUP:
+            if (!voiceGroups.Contains(offset))
+            {
+                const VoiceGroup &vg = ps.voiceGroups.Value(ps.voiceGroups.IndexOf(offset));
+
+                voiceGroups.Insert(offset, vg);
+                for (int j=0; j<VG_SIZE; j++)
+                {
+                    quint32 entry = offset + VG_ENTRY_LENGTH * j;
+                    if (vg.instruments[j].type == VOICE_PLACEHOLDER)
+                        voiceErrors.Insert(entry, ps.voiceErrors.Value(ps.voiceErrors.IndexOf(entry)));
+                }
+            }
+            break;
+
+        case ITEM_KEYSPLIT:
+            if (!keySplits.Contains(offset))
+                keySplits.Insert(offset, ps.keySplits.Value(ps.keySplits.IndexOf(offset)));
+            break;
+
+        //Samples are only queued, BuildSongFiles writes them
+        case ITEM_SAMPLE:
+            samples.Insert(offset);
+            break;
+
+        case ITEM_PWSAMPLE:
+            pwSamples.Insert(offset);
+            break;
+        }
     }
 
-    for (int i=0; i<elements; i++)
+    //Assembled songs don't go through mid2agb
+    if (ps.hasHeader && !ps.hasListing)
+        CreateSongMKEntry(ps.song, ps.header);
+    CreateLdScriptEntry(ps.song, ps.hasListing);
+
+    if (ps.hasListing)
+    {
+        listings.Insert(ps.song.headerPointer, ps.listing);
+        asmSongs.append(ps.song);
+    }
+    else if (ps.hasSequence)
     {
-        keySplit_list.append(IntToDecimalQString(splitData[i]));
+        //Songs sharing a header still get one file each, songs.mk asks for all of them
+        sequences.Insert(ps.song.headerPointer, ps.sequence);
+        midiSongs.append(ps.song);
     }
+}
+
+
+/* ****************************** *
+ * ********** Decoders ********** *
+ * ****************************** */
+static DirectSound DecodeDirectSound(Instrument ins)
+{
+    DirectSound dsound;
+
+    dsound.note = ins.data[0];
+    dsound.pan = ins.data[2];
+    dsound.sample = qFromLittleEndian<quint32>(ins.data + 3) & BINARY_POINTER_MASK;
+    dsound.atk = ins.data[7];
+    dsound.dec = ins.data[8];
+    dsound.sus = ins.data[9];
+    dsound.rel = ins.data[10];
+
+    return dsound;
+}
+
+//VoiceSquare_1 and VoiceSquare_2, the second one has no sweep
+static SquareSound DecodeSquareSound(Instrument ins)
+{
+    SquareSound ssound;
+
+    ssound.sweep = ins.data[2];
+    ssound.duty_cycle = ins.data[3];
+    ssound.atk = ins.data[7];
+    ssound.dec = ins.data[8];
+    ssound.sus = ins.data[9];
+    ssound.rel = ins.data[10];
+
+    return ssound;
+}
 
-    keySplit_map.insert(offset, keySplit_list);
+static ProgramableWave DecodeProgramableWave(Instrument ins)
+{
+    ProgramableWave pwave;
+
+    pwave.data = qFromLittleEndian<quint32>(ins.data + 3) & BINARY_POINTER_MASK;
+    pwave.atk = ins.data[7];
+    pwave.dec = ins.data[8];
+    pwave.sus = ins.data[9];
+    pwave.rel = ins.data[10];
+
+    return pwave;
 }
 
+static VoiceNoise DecodeVoiceNoise(Instrument ins)
+{
+    VoiceNoise vnoise;
+
+    vnoise.period = ins.data[3];
+    vnoise.atk = ins.data[7];
+    vnoise.dec = ins.data[8];
+    vnoise.sus = ins.data[9];
+    vnoise.rel = ins.data[10];
+
+    return vnoise;
+}
+
+//keysplit_all has no split table
+static VoiceKeysplit DecodeVoiceKeysplit(Instrument ins, quint8 mode)
+{
+    VoiceKeysplit vksplit;
+
+    vksplit.svg = qFromLittleEndian<quint32>(ins.data + 3) & BINARY_POINTER_MASK;
+
+    if (mode == INSTRUMENT_NORMAL)
+        vksplit.keysplit = qFromLittleEndian<quint32>(ins.data + 7) & BINARY_POINTER_MASK;
+    else
+        vksplit.keysplit = 0;
+
+    return vksplit;
+}
 
 /* ****************************** *
  * ****** Entry Generation ****** *
@@ -446,7 +676,7 @@ static QString CreateDirectSoundEntry(DirectSound ds, quint8 mode)
 
     entry += IntToDecimalQString(ds.note) + ", " +
             IntToDecimalQString(ds.pan) + ", " +
-            "DirectSoundWaveData_" + IntToHexQString(ds.sample) + ", " +
+            "DirectSoundWaveData_" + IntToHexQString(SampleSource(ds.sample)) + ", " +
             IntToDecimalQString(ds.atk) + ", " +
             IntToDecimalQString(ds.dec) + ", " +
             IntToDecimalQString(ds.sus) + ", " +
@@ -528,21 +758,61 @@ static QString CreateVoiceNoise(VoiceNoise vn, quint8 mode)
     return entry;
 }
 
+//Names are looked up here, once every voicegroup and keysplit has its id
 static QString CreateVoiceKeysplit(VoiceKeysplit vk, quint8 mode)
 {
     QString entry="";
 
     if (mode == INSTRUMENT_NORMAL)
-        entry += "\tvoice_keysplit svg_" +
-                IntToHexQString(vk.svg) + ", ksplit_" +
-                IntToHexQString(vk.keysplit);
+        entry += "\tvoice_keysplit voicegroup" +
+                IntToDecimalQString(VoiceGroupId(vk.svg)) + ", KeySplitTable" +
+                IntToDecimalQString(KeysplitId(vk.keysplit));
     else    //keysplit_all
-        entry += "\tvoice_keysplit_all svg_" +
-                IntToHexQString(vk.svg);
+        entry += "\tvoice_keysplit_all voicegroup" +
+                IntToDecimalQString(VoiceGroupId(vk.svg));
 
     return entry;
 }
 
+//Text of a voicegroup slot, entries are only rendered when the file is written
+static QString CreateVoiceEntry(const VoiceGroup &vg, int slot)
+{
+    Instrument ins = vg.instruments[slot];
+
+    switch (ins.type)
+    {
+    case DIRECT_SOUND:
+        return CreateDirectSoundEntry(DecodeDirectSound(ins), INSTRUMENT_NORMAL);
+    case DIRECT_SOUND_NO_R:
+        return CreateDirectSoundEntry(DecodeDirectSound(ins), INSTRUMENT_ALT);
+    case DIRECT_SOUND_ALT:
+        return CreateDirectSoundEntry(DecodeDirectSound(ins), INSTRUMENT_NO_RESAMPLE);
+    case VOICE_SQUARE_1:
+        return CreateSquareSound1Entry(DecodeSquareSound(ins), INSTRUMENT_NORMAL);
+    case VOICE_SQUARE_1_ALT:
+        return CreateSquareSound1Entry(DecodeSquareSound(ins), INSTRUMENT_ALT);
+    case VOICE_SQUARE_2:
+        return CreateSquareSound2Entry(DecodeSquareSound(ins), INSTRUMENT_NORMAL);
+    case VOICE_SQUARE_2_ALT:
+        return CreateSquareSound2Entry(DecodeSquareSound(ins), INSTRUMENT_ALT);
+    case VOICE_PROGRAMABLE_WAVE:
+        return CreateProgramableWaveEntry(DecodeProgramableWave(ins), INSTRUMENT_NORMAL);
+    case VOICE_PROGRAMABLE_WAVE_ALT:
+        return CreateProgramableWaveEntry(DecodeProgramableWave(ins), INSTRUMENT_ALT);
+    case VOICE_NOISE:
+        return CreateVoiceNoise(DecodeVoiceNoise(ins), INSTRUMENT_NORMAL);
+    case VOICE_NOISE_ALT:
+        return CreateVoiceNoise(DecodeVoiceNoise(ins), INSTRUMENT_ALT);
+    case VOICE_KEYSPLIT:
+        return CreateVoiceKeysplit(DecodeVoiceKeysplit(ins, INSTRUMENT_NORMAL), INSTRUMENT_NORMAL);
+    case VOICE_KEYSPLIT_ALL:
+        return CreateVoiceKeysplit(DecodeVoiceKeysplit(ins, INSTRUMENT_ALT), INSTRUMENT_ALT);
+    default:
+        return DEFAULT_VG_ENTRY + " \t\t@PLACEHOLDER: " +
+                voiceErrors.Value(voiceErrors.IndexOf(vg.offset + VG_ENTRY_LENGTH * slot));
+    }
+}
+
 static void CreateSongMKEntry(struct Song song, struct SongHeader header)
 {
     QString reverb, priority, voicegroup;
@@ -561,11 +831,7 @@ static void CreateSongMKEntry(struct Song song, struct SongHeader header)
     else
         priority = "-P" + IntToDecimalQString(header.priority);
 
-    //Calculates VoiceGroup id
-    if (vgIds_map[header.voiceGroupPointer] < 100)
-        voicegroup = "0" + IntToDecimalQString(vgIds_map[header.voiceGroupPointer]);
-    else
-        voicegroup = IntToDecimalQString(vgIds_map[header.voiceGroupPointer]);
+    voicegroup = VoiceGroupNumber(header.voiceGroupPointer);
 
     QString entry = "$(MID_SUBDIR)/mus_" + IntToDecimalQString(song.id) + ".s: %.s: %.mid" +
             "\n\t$(MID) $< $@ -E" + reverb + " -G" + voicegroup + " -V100 " + priority;
@@ -573,27 +839,77 @@ static void CreateSongMKEntry(struct Song song, struct SongHeader header)
     songMK_list.append(entry);
 }
 
+//Songs built by mid2agb are in MIDI_DIR, assembled ones in SONGS_DIR
+static void CreateLdScriptEntry(struct Song song, bool assembled)
+{
+    QString entry = "\t\t" + (assembled ? SONGS_DIR : MIDI_DIR) + "/mus_" +
+            IntToDecimalQString(song.id) + ".o(.rodata);";
+    ld_scripts_list.append(entry);
+}
+
 /* ****************************** *
  * ******* File Builders ******** *
  * ****************************** */
-void BuildSongFiles()
+//Writes every file, returns false if any of them couldn't be written.
+//DirectSound samples are converted by a pool of sampleWorkers threads
+//while the text files are written
+bool BuildSongFiles()
 {
-    RenameKeysplitSVGPointers();
-    RenameKeysplitPointers();
-    CreatePaths();
-    BuildSongTableFile();
-    BuildSongConstantsFile();
+    QThreadPool samplePool;
+    QList<QFuture<bool> > sampleFiles;
+    QList<QFuture<bool> > songFiles;
+    bool success = true;
 
-    BuildVoiceGroupsTable();
-    BuildKeySplitFile();
-    BuildDirectSoundDataFile();
-    BuildProgrammableWaveDataFile();
-    BuildLd_ScriptFile();
-    BuildSongsMKFile();
-    DeleteTempBinarySampleFiles();
+    CreatePaths();
+    CreatePath(OUTPUT_DIRECTORY + "/" + DS_SAMPLE_DIR);
+    CreatePath(OUTPUT_DIRECTORY + "/" + PW_SAMPLE_DIR);
+    CreatePath(OUTPUT_DIRECTORY + "/" + MIDI_DIR);
+    CreatePath(OUTPUT_DIRECTORY + "/" + SONGS_DIR);
+
+    if (sampleWorkers > 0)
+        samplePool.setMaxThreadCount(sampleWorkers);
+
+    //Identical samples are only converted once, similar ones too when merging
+    int uniqueSamples = DeduplicateSamples();
+    if (nearDuplicateMode != NEAR_DUPLICATES_OFF)
+        uniqueSamples = FindNearDuplicateSamples();
+
+    StartProgressPhase(50, 50, uniqueSamples + midiSongs.size() + asmSongs.size());
+    for (int i=0; i<samples.Size(); i++)
+        if (sampleSources[i] == i)
+            sampleFiles.append(QtConcurrent::run(&samplePool, BuildDirectSoundSampleFile, i));
+
+    //One song per task, they share the pool with the samples
+    for (int i=0; i<midiSongs.size(); i++)
+        songFiles.append(QtConcurrent::run(&samplePool, BuildMidiFile, midiSongs[i]));
+    for (int i=0; i<asmSongs.size(); i++)
+        songFiles.append(QtConcurrent::run(&samplePool, BuildAsmFile, asmSongs[i]));
+
+    success = BuildSongTableFile() && success;
+    success = BuildSongConstantsFile() && success;
+
+    success = BuildVoiceGroupsTable() && success;
+    success = BuildKeySplitFile() && success;
+    success = BuildDirectSoundDataFile() && success;
+    success = BuildProgrammableWaveDataFile() && success;
+    success = BuildLd_ScriptFile() && success;
+    success = BuildSongsMKFile() && success;
+
+    for (int i=0; i<pwSamples.Size(); i++)
+        success = BuildPcmSampleFile(pwSamples.At(i)) && success;
+
+    //Every sample and song file is written before the extraction is reported as done
+    samplePool.waitForDone();
+
+    for (int i=0; i<sampleFiles.size(); i++)
+        success = sampleFiles[i].result() && success;
+    for (int i=0; i<songFiles.size(); i++)
+        success = songFiles[i].result() && success;
+
+    return success;
 }
 
-static void BuildSongTableFile()
+static bool BuildSongTableFile()
 {
     QFile f (OUTPUT_DIRECTORY + SONG_TABLE_FILE);
 
@@ -607,10 +923,12 @@ static void BuildSongTableFile()
         }
         s.flush();
         f.close();
+        return true;
     }
+    return false;
 }
 
-static void BuildSongConstantsFile()
+static bool BuildSongConstantsFile()
 {
     QFile f(OUTPUT_DIRECTORY+"/include/constants/songs.h");
 
@@ -624,68 +942,62 @@ static void BuildSongConstantsFile()
         }
         out.flush();
         f.close();
+        return true;
     }
+    return false;
 }
 
 //VG Individual .inc file
-static void BuildVoiceGroupFile(quint32 vgOffset)
+static bool BuildVoiceGroupFile(quint32 vgOffset)
 {
-    QStringList vg;
-
     QFile f(OUTPUT_DIRECTORY +
             VG_DIR + "/voicegroup" +
-            IntToDecimalQString(vgIds_map[vgOffset]) +
+            IntToDecimalQString(VoiceGroupId(vgOffset)) +
             ".inc");
 
     if (f.open(QIODevice::ReadWrite))
     {
         QTextStream out(&f);
 
-        vg = voiceGroups_map[vgOffset];
+        const VoiceGroup &vg = voiceGroups.Value(voiceGroups.IndexOf(vgOffset));
 
         out << "\n\t.align 2\n";
         out << "voicegroup" +
-                    IntToDecimalQString(vgIds_map[vgOffset]) +
+                    IntToDecimalQString(VoiceGroupId(vgOffset)) +
                     ":: @ " + IntToHexQString(vgOffset) + "\n";
 
         for (int j=0; j<VG_SIZE; j++)
-            out << vg[j] + "\n";
+            out << CreateVoiceEntry(vg, j) + "\n";
+        return true;
     }
+    return false;
 }
 
 //Table with all voicegroups
-static void BuildVoiceGroupsTable()
+static bool BuildVoiceGroupsTable()
 {
-    //QStringList vg;
-
-    QMap<quint16, quint32> vgById;
-    QMapIterator<quint32, quint16> it(vgIds_map);
-
-    while (it.hasNext())
-    {
-        it.next();
-        vgById.insert(it.value(), it.key());
-    }
-
     QFile f(OUTPUT_DIRECTORY + VOICE_GROUP_TABLE_FILE);
+    bool success = true;
 
     if (f.open(QIODevice::ReadWrite))
     {
         QTextStream out(&f);
 
-        for (int i=pretvgTableSize; i<pretvgTableSize+vgIds_map.size(); i++)
+        for (int i=0; i<voiceGroups.Size(); i++)
         {
             out << "\n.include \"sound/voicegroups/voicegroup" +
-                   IntToDecimalQString(i) + ".inc\"";
-            BuildVoiceGroupFile(vgById[i]);
+                   IntToDecimalQString(VoiceGroupId(voiceGroups.At(i))) + ".inc\"";
+            success = BuildVoiceGroupFile(voiceGroups.At(i)) && success;
         }
 
         out.flush();
         f.close();
+        return success;
     }
+    return false;
 }
 
-static void BuildKeySplitFile()
+static bool BuildKeySplitFile()
 {
     QStringList ks;
     QFile f(OUTPUT_DIRECTORY + KEYSPLIT_FILE);
@@ -693,16 +1005,13 @@ static void BuildKeySplitFile()
     if(f.open(QIODevice::ReadWrite))
     {
         QTextStream out(&f);
-        QMapIterator<quint16, quint32> it(ksplitIds_map);
 
-
-        while (it.hasNext())
+        for (int j=0; j<keySplits.Size(); j++)
         {
-            it.next();
-            ks = keySplit_map[it.value()];
+            ks = keySplits.Value(j);
 
             out << "\n\n.set KeySplitTable" +
-                   IntToDecimalQString(it.key()) + ", . - " +
+                   IntToDecimalQString(KeysplitId(keySplits.At(j))) + ", . - " +
                    IntToDecimalQString(0);  //KEYSPLIT_MAX_ELEMENTS - ks.size()
 
             for (int i=0; i<ks.size(); i++)
@@ -712,10 +1021,12 @@ static void BuildKeySplitFile()
         }
         out.flush();
         f.close();
+        return true;
     }
+    return false;
 }
 
-static void BuildLd_ScriptFile()
+static bool BuildLd_ScriptFile()
 {
     QFile f(OUTPUT_DIRECTORY + LD_SCRIPT_FILE);
 
@@ -723,17 +1034,18 @@ static void BuildLd_ScriptFile()
     {
         QTextStream out(&f);
 
-        for(int i=0; i<songTable_list.size(); i++)
+        for(int i=0; i<ld_scripts_list.size(); i++)
         {
-            out << "\n\t\t" + MIDI_DIR + "/mus_" +
-                   IntToDecimalQString(pretSongTableSize + i +1)+ ".o(.rodata);";
+            out << "\n" + ld_scripts_list[i];
         }
         out.flush();
+        f.close();
+        return true;
     }
-    f.close();
+    return false;
 }
 
-static void BuildSongsMKFile()
+static bool BuildSongsMKFile()
 {
     QFile f(OUTPUT_DIRECTORY + SONG_MK_FILE);
 
@@ -747,10 +1059,12 @@ static void BuildSongsMKFile()
         }
         out.flush();
         f.close();
+        return true;
     }
+    return false;
 }
 
-static void BuildDirectSoundDataFile()
+static bool BuildDirectSoundDataFile()
 {
     QFile f(OUTPUT_DIRECTORY + DSOUND_DATA_FILE);
 
@@ -758,21 +1072,36 @@ static void BuildDirectSoundDataFile()
     {
         QTextStream out(&f);
 
-        for (int i=0; i<sample_list.size(); i++)
+        QVector<QList<quint32> > aliases(samples.Size());
+
+        for (int i=0; i<samples.Size(); i++)
+            if (sampleSources[i] != i)
+                aliases[sampleSources[i]].append(samples.At(i));
+
+        for (int i=0; i<samples.Size(); i++)
         {
+            if (sampleSources[i] != i)
+                continue;
+
             out << "\n\t.align 2";
             out << "\nDirectSoundWaveData_" +
-                   IntToHexQString(sample_list[i]) + "::";
+                   IntToHexQString(samples.At(i)) + "::";
+            //Identical samples at other offsets share the data
+            for (int j=0; j<aliases[i].size(); j++)
+                out << "\nDirectSoundWaveData_" +
+                       IntToHexQString(aliases[i][j]) + "::";
             out << "\n\t.incbin \"" + DS_SAMPLE_DIR +
-                   "/" + IntToHexQString(sample_list[i]) +
+                   "/" + IntToHexQString(samples.At(i)) +
                    BIN_EXTENSION +"\"\n";
         }
         out.flush();
         f.close();
+        return true;
     }
+    return false;
 }
 
-static void BuildProgrammableWaveDataFile()
+static bool BuildProgrammableWaveDataFile()
 {
     QFile f(OUTPUT_DIRECTORY + PWAVE_DATA_FILE);
 
@@ -780,78 +1109,322 @@ static void BuildProgrammableWaveDataFile()
     {
         QTextStream out(&f);
 
-        for (int i=0; i<pwSample_list.size(); i++)
+        for (int i=0; i<pwSamples.Size(); i++)
         {
             out << "\n\nProgrammableWaveData_" +
-                   IntToHexQString(pwSample_list[i]) + "::";
+                   IntToHexQString(pwSamples.At(i)) + "::";
             out << "\n\t.incbin \"" + PW_SAMPLE_DIR +
-                   "/" + IntToHexQString(pwSample_list[i]) +
+                   "/" + IntToHexQString(pwSamples.At(i)) +
                    PWS_EXTENSION + "\"";
         }
         out.flush();
         f.close();
+        return true;
+    }
+    return false;
+}
+
+//Writes the sample straight from the ROM in sampleFormat, no temporary .bin is
+//written, or takes it from the sample cache if an earlier run already converted it.
+//Runs on the sample pool, it only reads the ROM and its own file
+static bool BuildDirectSoundSampleFile(int index)
+{
+    const SampleSink &sink = sampleSinks[sampleFormat];
+    bool written;
+
+    if (IsCancelled())
+        return false;
+
+    RomSpan data;
+    QByteArray resampled;
+    quint32 sample = samples.At(index);
+    QString variant = (sampleRate > 0 ? "-r" + QString::number(sampleRate) : "") + sink.extension;
+    QString path = OUTPUT_DIRECTORY + "/" + DS_SAMPLE_DIR +
+            "/" + IntToHexQString(sample) + sink.extension;
+
+    //Already checked when parsing, but nothing can be thrown out of the pool
+    try {
+        data = ReadSampleSpan(sample);
+    } catch (QString) {
+        return false;
+    }
+
+    if (sink.cached && FetchCachedSample(sampleHashes[index], AIF_BASE_NOTE, variant, path))
+    {
+        ReportProgress();
+        return true;
+    }
+
+    //The writers read the new rate and loop from the rewritten header
+    if (sampleRate > 0)
+    {
+        resampled = ResampleSample(sample, data);
+        if (!resampled.isEmpty())
+        {
+            data.data = reinterpret_cast<const uchar*>(resampled.constData());
+            data.length = resampled.size();
+        }
     }
+
+    //calls aif2pcm by @huderlem
+    written = sink.write(data.data, data.length, QFile::encodeName(path).constData(), AIF_BASE_NOTE);
+
+    if (written && sink.cached)
+        StoreCachedSample(sampleHashes[index], AIF_BASE_NOTE, variant, path);
+
+    ReportProgress();
+    return written;
 }
 
-static void BuildTempSampleBinary(quint32 sample)
+static bool BuildPcmSampleFile(quint32 pcm)
 {
-    quint32 sampleLenght;
-    QString path = OUTPUT_DIRECTORY + "/" + DS_SAMPLE_DIR;
-    CreatePath(path);
-    path += "/" + IntToHexQString(sample) + BIN_EXTENSION;
+    RomSpan data = rom.ReadSpan(pcm, SAMPLE_HEADER_LENGTH);
+    QString path = OUTPUT_DIRECTORY + "/" + PW_SAMPLE_DIR +
+            "/" + IntToHexQString(pcm) + PWS_EXTENSION;
 
     QFile f(path);
     if (f.open(QIODevice::ReadWrite))
     {
-        QDataStream out(&f);
-        sampleLenght = ReadROMHWordAt(sample + SAMPLE_LENGTH_OFFSET);   //Change by C
-
-        for (quint32 i=0; i<(sampleLenght+SAMPLE_HEADER_LENGTH); i++)
-            out << ReadROMByteAt(sample + i);
+        bool written = f.write(reinterpret_cast<const char*>(data.data), data.length) == data.length;
         f.close();
+        return written;
     }
-    BuildAifSampleFile(path);
+    return false;
 }
 
-static void BuildAifSampleFile(QString path)
+//sound/songs/midi/mus_N.mid, built in memory and written at once
+static bool BuildMidiFile(Song song)
 {
-    //This conversion might not be optimal, not really sure about this
-    //Converting QString into char*
-    std::string str = path.toStdString();
-    char *cstr = new char[str.length()+1];
-    strcpy(cstr, str.c_str());
+    if (IsCancelled())
+        return false;
 
-    main_aif2pcm(cstr); //calls aif2pcm by @huderlem
+    const SongSequence &sequence = sequences.Value(sequences.IndexOf(song.headerPointer));
+    QByteArray midi = SequenceToMidi(sequence);
+    QFile f(OUTPUT_DIRECTORY + "/" + MIDI_DIR + "/mus_" + IntToDecimalQString(song.id) + MIDI_EXTENSION);
+    bool written = false;
+
+    if (f.open(QIODevice::WriteOnly))
+    {
+        written = f.write(midi) == midi.size();
+        f.close();
+    }
+
+    ReportProgress();
+    return written;
 }
 
-static void DeleteTempBinarySampleFiles()
+//sound/songs/mus_N.s, pret assembles it without mid2agb
+static bool BuildAsmFile(Song song)
 {
-    QString path;
+    if (IsCancelled())
+        return false;
+
+    const SongListing &listing = listings.Value(listings.IndexOf(song.headerPointer));
+    QByteArray text = SongListingToAsm(listing, "mus_" + IntToDecimalQString(song.id),
+                                       "voicegroup" + VoiceGroupNumber(listing.voiceGroup)).toUtf8();
+    QFile f(OUTPUT_DIRECTORY + "/" + SONGS_DIR + "/mus_" + IntToDecimalQString(song.id) + ASM_EXTENSION);
+    bool written = false;
 
-    for (int i=0; i<sample_list.size(); i++)
+    if (f.open(QIODevice::WriteOnly))
     {
-        path = OUTPUT_DIRECTORY + "/" + DS_SAMPLE_DIR + "/" +
-                IntToHexQString(sample_list[i]) + BIN_EXTENSION;
-        QFile f(path);
-        f.remove();
+        written = f.write(text) == text.size();
         f.close();
     }
+
+    ReportProgress();
+    return written;
 }
 
-static void BuildPcmSampleFile(quint32 pcm)
+/* ****************************** *
+ * ******* Song Rendering ******* *
+ * ****************************** */
+//Renders every extracted song to folder/mus_N.wav, one song per task. The
+//voicegroups the songs use are decoded first so the tasks only read them
+bool RenderSongs(QString folder)
 {
-    QString path = OUTPUT_DIRECTORY + "/" + PW_SAMPLE_DIR;
-    CreatePath(path);
-    path += "/" + IntToHexQString(pcm) + PWS_EXTENSION;
+    QThreadPool renderPool;
+    QList<QFuture<bool> > renders;
+    QList<Song> songs = midiSongs;
+    bool success = true;
 
-    QFile f(path);
-    if (f.open(QIODevice::ReadWrite))
+    songs.append(asmSongs);
+    CreatePath(folder);
+    renderGroups.Clear();
+    renderSamples.Clear();
+
+    if (sampleWorkers > 0)
+        renderPool.setMaxThreadCount(sampleWorkers);
+
+    for (int i=0; i<songs.size(); i++)
     {
-        QDataStream out(&f);
-        for (int i=0; i<SAMPLE_HEADER_LENGTH; i++)
-            out << ReadROMByteAt(pcm + i);
+        quint32 vgOffset = rom.ReadPointer(songs[i].headerPointer + 4);
+
+        if (!renderGroups.Contains(vgOffset))
+            renderGroups.Insert(vgOffset, BuildRenderVoiceGroup(vgOffset));
+    }
+
+    for (int i=0; i<songs.size(); i++)
+        renders.append(QtConcurrent::run(&renderPool, RenderSongFile, songs[i], folder));
+
+    renderPool.waitForDone();
+
+    for (int i=0; i<renders.size(); i++)
+        success = renders[i].result() && success;
+
+    //Songs extracted as assembly filled it again
+    ClearSequenceCache();
+
+    return success;
+}
+
+//A keysplit slot takes its voices from its voicegroup, which was parsed with the song
+static RenderVoiceGroup BuildRenderVoiceGroup(quint32 vgOffset)
+{
+    RenderVoiceGroup group;
+    int index = voiceGroups.IndexOf(vgOffset);
+
+    group.instruments.resize(VG_SIZE);
+
+    if (index < 0)
+        return group;
+
+    for (int i=0; i<VG_SIZE; i++)
+        group.instruments[i] = BuildRenderInstrument(voiceGroups.Value(index).instruments[i]);
+
+    return group;
+}
+
+static RenderInstrument BuildRenderInstrument(Instrument ins)
+{
+    RenderInstrument instrument;
+
+    instrument.rhythm = ins.type == VOICE_KEYSPLIT_ALL;
+
+    if (ins.type != VOICE_KEYSPLIT && ins.type != VOICE_KEYSPLIT_ALL)
+    {
+        instrument.voices.append(BuildRenderVoice(ins));
+        return instrument;
+    }
+
+    VoiceKeysplit vksplit = DecodeVoiceKeysplit(ins, instrument.rhythm ? INSTRUMENT_ALT : INSTRUMENT_NORMAL);
+    int index = voiceGroups.IndexOf(vksplit.svg);
+
+    if (index < 0)
+        return instrument;
+
+    //The driver indexes the table by the note, bytes before the first split included
+    instrument.split.resize(KEYSPLIT_MAX_ELEMENTS);
+    for (int key=0; key<KEYSPLIT_MAX_ELEMENTS; key++)
+    {
+        if (instrument.rhythm)
+            instrument.split[key] = key;
+        else if (rom.Contains(vksplit.keysplit + key, 1))
+            instrument.split[key] = rom.ReadByte(vksplit.keysplit + key) & 0x7F;
+        else
+            instrument.split[key] = 0;
+    }
+
+    //The driver doesn't nest keysplits, the ones inside stay silent
+    for (int i=0; i<VG_SIZE; i++)
+        instrument.voices.append(BuildRenderVoice(voiceGroups.Value(index).instruments[i]));
+
+    return instrument;
+}
+
+//DirectSound with its envelope, everything else is silent
+static RenderVoice BuildRenderVoice(Instrument ins)
+{
+    RenderVoice voice;
+
+    if (ins.type != DIRECT_SOUND && ins.type != DIRECT_SOUND_NO_R && ins.type != DIRECT_SOUND_ALT)
+    {
+        voice.type = RENDER_VOICE_SILENT;
+        return voice;
+    }
+
+    DirectSound dsound = DecodeDirectSound(ins);
+
+    voice = BuildRenderSample(dsound.sample);
+    if (voice.type != RENDER_VOICE_SILENT && ins.type == DIRECT_SOUND_NO_R)
+        voice.type = RENDER_VOICE_FIXED;
+    voice.key = dsound.note;
+    voice.pan = dsound.pan;
+    voice.atk = dsound.atk;
+    voice.dec = dsound.dec;
+    voice.sus = dsound.sus;
+    voice.rel = dsound.rel;
+
+    return voice;
+}
+
+//Float PCM of a sample, decoded once for every voice playing it
+static RenderVoice BuildRenderSample(quint32 sample)
+{
+    int index = renderSamples.IndexOf(sample);
+    RenderVoice voice;
+    unsigned long length = 0;
+
+    if (index >= 0)
+        return renderSamples.Value(index);
+
+    voice.type = RENDER_VOICE_SILENT;
+    voice.length = 0;
+    voice.loopStart = RENDER_NO_LOOP;
+    voice.rate = 0;
+
+    try {
+        SampleHeader header = ReadSampleHeader(sample);
+        RomSpan data = ReadSampleSpan(sample);
+        uint8_t *pcm = read_sample_data(data.data, data.length, &length);
+
+        if (pcm && length > 0)
+        {
+            const qint8 *samples = reinterpret_cast<const qint8*>(pcm);
+            bool loops = (header.flags & SAMPLE_FLAG_LOOP) && header.loopStart < length;
+
+            voice.type = RENDER_VOICE_SAMPLE;
+            voice.length = length;
+            voice.loopStart = loops ? qint32(header.loopStart) : RENDER_NO_LOOP;
+            voice.rate = header.pitch / 1024.0;
+            voice.pcm.resize(length + 1);
+            for (unsigned long i=0; i<length; i++)
+                voice.pcm[i] = samples[i] / 128.0f;
+            voice.pcm[length] = loops ? voice.pcm[header.loopStart] : 0.0f;
+        }
+        free(pcm);
+
+    } catch (QString) {
+        voice.type = RENDER_VOICE_SILENT;
+    }
+
+    renderSamples.Insert(sample, voice);
+    return voice;
+}
+
+//folder/mus_N.wav. Songs extracted as assembly have no decoded tracks, they're decoded here
+static bool RenderSongFile(Song song, QString folder)
+{
+    if (IsCancelled())
+        return false;
+
+    try {
+        RomSpan header = rom.ReadSpan(song.headerPointer, SONG_HEADER_LENGTH);
+        int group = renderGroups.IndexOf(header.Pointer(4));
+        int index = sequences.IndexOf(song.headerPointer);
+        SongSequence sequence = index >= 0 ? sequences.Value(index) : DecodeSongSequence(rom, song.headerPointer);
+        QByteArray wav = RenderSongToWav(sequence, renderGroups.Value(group), header.Byte(3));
+        QFile f(folder + "/mus_" + IntToDecimalQString(song.id) + WAV_EXTENSION);
+
+        if (!f.open(QIODevice::WriteOnly))
+            return false;
+
+        bool written = f.write(wav) == wav.size();
+        f.close();
+        return written;
+
+    } catch (QString) {
+        return false;
     }
-    f.close();
 }
 
 /* ****************************** *
@@ -873,52 +1446,311 @@ static void CreatePath(QString path)
         dir.mkpath(path);
 }
 
-static void RenameKeysplitSVGPointers()
+//Moves every staged file to its final path, replacing older files. Each one
+//is renamed over its destination, and the files it replaces are copied to a
+//backup folder first so a failure can put back the ones already published
+static bool PublishStagedFiles(QString stagingPath, QString path)
 {
-    QStringList vg;
-    quint32 offset;
-    quint16 id;
+    QDir staging(stagingPath);
+    QDirIterator it(stagingPath, QDir::Files, QDirIterator::Subdirectories);
+    QString backupPath = path + BACKUP_SUFFIX;
+    QStringList published;
+    bool ok = true;
 
-    QMapIterator<quint32, quint16> i(vgIds_map);
+    QDir(backupPath).removeRecursively();
 
-    while(i.hasNext())
+    while (ok && it.hasNext())
     {
-        i.next();
-        offset = i.key();
-        id = i.value();
+        QString file = it.next();
+        QString relative = staging.relativeFilePath(file);
+        QString dest = path + "/" + relative;
+        QString backup = backupPath + "/" + relative;
 
-        QMapIterator<quint32, QStringList> i_vg(voiceGroups_map);
+        CreatePath(QFileInfo(dest).path());
+        if (QFile::exists(dest))
+        {
+            CreatePath(QFileInfo(backup).path());
+            ok = QFile::copy(dest, backup);
+        }
+
+        if (ok)
+            ok = RenameFileOver(file, dest);
+        if (ok)
+            published.append(relative);
+    }
 
-        while(i_vg.hasNext())
+    //Newest first, a published file either gets its old version back or goes away
+    if (!ok)
+    {
+        for (int i=published.size() - 1; i>=0; i--)
         {
-            i_vg.next();
-            voiceGroups_map[i_vg.key()].replaceInStrings("svg_" + IntToHexQString(offset),
-                                                         "voicegroup" + IntToDecimalQString(id));
+            QString dest = path + "/" + published[i];
+            QString backup = backupPath + "/" + published[i];
+
+            if (QFile::exists(backup))
+                RenameFileOver(backup, dest);
+            else
+                QFile::remove(dest);
         }
     }
+
+    QDir(backupPath).removeRecursively();
+    return ok;
 }
 
-static void RenameKeysplitPointers()
+//Finds samples with the same header and data, hashed first and then compared.
+//sampleSources[i] is the index of the first sample with the content of sample i,
+//returns how many different samples there are
+static int DeduplicateSamples()
 {
-    QStringList vg;
-    quint32 offset;
-    quint16 id;
+    QHash<Hash128, QList<int> > byHash;
+    QVector<RomSpan> spans(samples.Size());
+    int unique = 0;
 
-    QMapIterator<quint16, quint32> i(ksplitIds_map);
+    sampleSources.fill(0, samples.Size());
+    sampleHashes.fill(Hash128(), samples.Size());
 
-    while(i.hasNext())
+    for (int i=0; i<samples.Size(); i++)
     {
-        i.next();
-        offset = i.value();
-        id = i.key();
+        sampleSources[i] = i;
+
+        try {
+            spans[i] = ReadSampleSpan(samples.At(i));
+        } catch (QString) {
+            unique++;       //Never shared, its conversion fails anyway
+            continue;
+        }
 
-        QMapIterator<quint32, QStringList> i_vg(voiceGroups_map);
+        sampleHashes[i] = Murmur3Hash128(spans[i].data, spans[i].length);
+        QList<int> &candidates = byHash[sampleHashes[i]];
 
-        while (i_vg.hasNext())
+        for (int j=0; j<candidates.size(); j++)
         {
-            i_vg.next();
-            voiceGroups_map[i_vg.key()].replaceInStrings("ksplit_" + IntToHexQString(offset),
-                                                         "KeySplitTable" + IntToDecimalQString(id));
+            RomSpan other = spans[candidates[j]];
+
+            if (other.length == spans[i].length && memcmp(other.data, spans[i].data, other.length) == 0)
+            {
+                sampleSources[i] = candidates[j];
+                break;
+            }
+        }
+
+        if (sampleSources[i] == i)
+        {
+            candidates.append(i);
+            unique++;
         }
     }
+
+    return unique;
+}
+
+//Groups samples that differ only in padding, loop point or a few bytes, see
+//sample_similarity. Fingerprints are taken in parallel, one per different sample.
+//Merging points every sample of a group at the first one, like identical samples.
+//Returns how many different samples are left
+static int FindNearDuplicateSamples()
+{
+    QList<int> candidates;
+    QHash<int, QList<int> > groups;
+    int unique = 0;
+
+    for (int i=0; i<samples.Size(); i++)
+    {
+        if (sampleSources[i] != i)
+            continue;
+
+        unique++;
+
+        //Unreadable samples would all look like silence
+        try {
+            ReadSampleSpan(samples.At(i));
+            candidates.append(i);
+        } catch (QString) {
+        }
+    }
+
+    QVector<SampleFingerprint> fingerprints =
+            QtConcurrent::blockingMapped<QVector<SampleFingerprint> >(candidates, FingerprintSample);
+    QVector<int> clusters = ClusterFingerprints(fingerprints);
+
+    for (int i=0; i<clusters.size(); i++)
+        groups[candidates[clusters[i]]].append(candidates[i]);
+
+    for (int i=0; i<candidates.size(); i++)
+    {
+        QList<int> group = groups.value(candidates[i]);
+
+        if (group.size() < 2)
+            continue;
+
+        QList<quint32> offsets;
+        for (int j=0; j<group.size(); j++)
+            offsets.append(samples.At(group[j]));
+        nearDuplicates.append(offsets);
+
+        if (nearDuplicateMode == NEAR_DUPLICATES_MERGE)
+            unique -= group.size() - 1;
+    }
+
+    if (nearDuplicateMode == NEAR_DUPLICATES_MERGE)
+    {
+        QVector<int> kept(samples.Size());
+
+        for (int i=0; i<samples.Size(); i++)
+            kept[i] = i;
+        for (int i=0; i<clusters.size(); i++)
+            kept[candidates[i]] = candidates[clusters[i]];
+
+        for (int i=0; i<samples.Size(); i++)
+            sampleSources[i] = kept[sampleSources[i]];
+    }
+
+    return unique;
+}
+
+//Runs on the global pool, the span was checked before
+static SampleFingerprint FingerprintSample(int index)
+{
+    RomSpan data = ReadSampleSpan(samples.At(index));
+    unsigned long length = 0;
+    uint8_t *pcm = read_sample_data(data.data, data.length, &length);
+    SampleFingerprint fp = FingerprintPcm(reinterpret_cast<const qint8*>(pcm), length);
+
+    free(pcm);
+    return fp;
+}
+
+//Near-duplicate sample groups found by the last extraction, by offset
+QList<QList<quint32> > NearDuplicateSamples()
+{
+    return nearDuplicates;
+}
+
+//Offset of the sample whose symbol and file are used for this one
+static quint32 SampleSource(quint32 sample)
+{
+    int index = samples.IndexOf(sample);
+
+    if (index < 0 || index >= sampleSources.size())
+        return sample;
+
+    return samples.At(sampleSources[index]);
+}
+
+//Decodes the 16 byte m4a sample header
+static SampleHeader ReadSampleHeader(quint32 sample)
+{
+    RomSpan data = rom.ReadSpan(sample, SAMPLE_HEADER_LENGTH);
+    SampleHeader header;
+
+    header.flags = data.Word(SAMPLE_FLAGS_OFFSET);
+    header.pitch = data.Word(SAMPLE_PITCH_OFFSET);
+    header.loopStart = data.Word(SAMPLE_LOOP_OFFSET);
+    header.size = data.Word(SAMPLE_LENGTH_OFFSET);
+
+    return header;
+}
+
+//The sample at sampleRate as a new uncompressed sample (header + data), with its
+//loop moved to match. Empty if it's already at that rate or has no rate at all
+static QByteArray ResampleSample(quint32 sample, RomSpan data)
+{
+    SampleHeader header = ReadSampleHeader(sample);
+    unsigned long length;
+
+    if (header.pitch == 0 || header.pitch == sampleRate * 1024)
+        return QByteArray();
+
+    uint8_t *pcm = read_sample_data(data.data, data.length, &length);
+    if (!pcm)
+        return QByteArray();
+
+    ResampledPcm out = ResamplePcm(reinterpret_cast<const qint8*>(pcm), length,
+                                   (header.flags & SAMPLE_FLAG_LOOP) ? qint32(header.loopStart) : RESAMPLE_NO_LOOP,
+                                   header.pitch / 1024.0, sampleRate);
+    free(pcm);
+
+    QByteArray resampled(SAMPLE_HEADER_LENGTH + out.samples.size(), 0);
+    uchar *bytes = reinterpret_cast<uchar*>(resampled.data());
+    quint32 flags = header.flags & ~(SAMPLE_FLAG_COMPRESSED | SAMPLE_FLAG_LOOP);
+
+    if (out.loopStart != RESAMPLE_NO_LOOP)
+        flags |= SAMPLE_FLAG_LOOP;
+
+    qToLittleEndian<quint32>(flags, bytes + SAMPLE_FLAGS_OFFSET);
+    qToLittleEndian<quint32>(sampleRate * 1024, bytes + SAMPLE_PITCH_OFFSET);
+    qToLittleEndian<quint32>(out.loopStart != RESAMPLE_NO_LOOP ? out.loopStart : 0, bytes + SAMPLE_LOOP_OFFSET);
+    qToLittleEndian<quint32>(out.samples.size() - 1, bytes + SAMPLE_LENGTH_OFFSET);
+    memcpy(bytes + SAMPLE_HEADER_LENGTH, out.samples.constData(), out.samples.size());
+
+    return resampled;
+}
+
+//Header and data of a DirectSound sample, exactly as long as its header says.
+//Compressed samples are sized by their delta blocks
+static RomSpan ReadSampleSpan(quint32 sample)
+{
+    SampleHeader header = ReadSampleHeader(sample);
+    quint32 length;
+
+    if (header.size >= rom.Size())
+    {
+        QString msg = "Bad sample size \"" + IntToHexQString(header.size) + "\"";
+        throw msg;
+    }
+
+    if (header.flags & SAMPLE_FLAG_COMPRESSED)
+        length = delta_compressed_length(header.size + 1);
+    else
+        length = header.size + 1;
+
+    return rom.ReadSpan(sample, SAMPLE_HEADER_LENGTH + length);
+}
+
+static bool IsCancelled()
+{
+    return cancelRequested && cancelRequested();
+}
+
+//The next steps ReportProgress calls go from base to base + span percent
+static void StartProgressPhase(quint8 base, quint8 span, quint32 steps)
+{
+    QMutexLocker locker(&progressMutex);
+
+    progressBase = base;
+    progressSpan = span;
+    progressDone = 0;
+    progressTotal = steps;
+}
+
+//One step of the current phase is done, thread safe
+static void ReportProgress()
+{
+    QMutexLocker locker(&progressMutex);
+
+    progressDone++;
+
+    if (progressReport && progressTotal > 0)
+        progressReport(progressBase + progressDone * progressSpan / progressTotal);
+}
+
+//Voicegroups are numbered after the pret ones in the order they were found
+static quint16 VoiceGroupId(quint32 vgOffset)
+{
+    return pretvgTableSize + voiceGroups.IndexOf(vgOffset);
+}
+
+//Voicegroup id the way songs.mk passes it to mid2agb (-G)
+static QString VoiceGroupNumber(quint32 vgOffset)
+{
+    if (VoiceGroupId(vgOffset) < 100)
+        return "0" + IntToDecimalQString(VoiceGroupId(vgOffset));
+    return IntToDecimalQString(VoiceGroupId(vgOffset));
+}
+
+//Keysplit tables are numbered from one past the pret ones
+static quint16 KeysplitId(quint32 ksOffset)
+{
+    return pretKsTableSize + 1 + keySplits.IndexOf(ksOffset);
 }
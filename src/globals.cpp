@@ -4,8 +4,11 @@
 #include <QStringList>
 
 QFile romFile;
-QByteArray romHex;
-quint8 romType;
+QByteArray romHex;               //Only used when the ROM can't be mapped
+RomView rom;
+const RomProfile *romProfile;
+quint32 romCrc32;
+quint8 romDumpStatus;
 quint32 romSongTableOffset;
 quint32 romSongTableSize;
 
@@ -22,3 +25,8 @@ bool romReady;
 bool pretReady;
 bool automaticSongNames = true;
 bool overridePret = false;
+int sampleWorkers = 0;            //Sample conversion threads, 0 is one per core
+quint8 sampleFormat = SAMPLE_FORMAT_AIF;    //File written for each DirectSound sample
+quint8 nearDuplicateMode = NEAR_DUPLICATES_OFF;
+quint32 sampleRate = 0;           //DirectSound samples are resampled to it, 0 keeps their own rate
+quint8 songFormat = SONG_FORMAT_MIDI;       //mus_N.mid for mid2agb or mus_N.s assembled as is
@@ -0,0 +1,375 @@
+#include "include/m4a_disassembler.h"
+#include "include/binary_utils.h"
+#include "include/offset_index.h"
+#include <algorithm>
+
+//Commands found so far and the jumps still to be labelled
+struct Disassembly {
+    const RomView *rom;
+    OffsetIndex<AsmCommand> commands;
+    OffsetIndex<quint8> patternExits;   //Running status after the PEND of each pattern
+    QVector<AsmCommand> jumps;          //Commands with a target, to label it once decoded
+    quint32 count;
+};
+
+static quint8 DecodeFrom(Disassembly &d, quint32 offset, quint8 running, quint8 track, int depth);
+static void LabelTarget(Disassembly &d, const AsmCommand &jump);
+static QString CommandName(quint8 command);
+static QString ArgumentText(const QString &name, const AsmCommand &c, int arg);
+static QString KeyName(quint8 key);
+
+//MPlayDef.s note names, octave -2 (M2) to 8
+static const char *const noteNames[] = {"Cn", "Cs", "Dn", "Ds", "En", "Fn", "Fs", "Gn", "Gs", "An", "As", "Bn"};
+
+//Finds every command the tracks of the song reach, the way the sound driver
+//would play them, so the listing can be assembled back to the same bytes.
+//Throws a QString if a track can't be read or jumps into the middle of a command
+SongListing DisassembleSong(const RomView &rom, quint32 songHeader)
+{
+    SongListing listing;
+    Disassembly d;
+    quint8 trackCount = rom.ReadByte(songHeader);
+
+    if (trackCount > M4A_MAX_TRACKS)
+    {
+        QString msg = "Bad track count \"" + IntToDecimalQString(trackCount) + "\"";
+        throw msg;
+    }
+
+    listing.header = songHeader;
+    listing.blocks = rom.ReadByte(songHeader + 1);
+    listing.priority = rom.ReadByte(songHeader + 2);
+    listing.reverb = rom.ReadByte(songHeader + 3);
+    listing.voiceGroup = rom.ReadPointer(songHeader + 4);
+
+    d.rom = &rom;
+    d.count = 0;
+
+    for (int i=0; i<trackCount; i++)
+    {
+        listing.tracks.append(rom.ReadPointer(songHeader + M4A_TRACK_POINTERS_OFFSET + i * 4));
+        DecodeFrom(d, listing.tracks[i], 0, i, 0);
+    }
+
+    for (int i=0; i<d.jumps.size(); i++)
+        LabelTarget(d, d.jumps[i]);
+
+    //Track starts are labelled even when another track got there first
+    for (int i=0; i<trackCount; i++)
+    {
+        AsmCommand &start = d.commands.Value(d.commands.IndexOf(listing.tracks[i]));
+        if (start.label != ASM_LABEL_TRACK)
+        {
+            start.label = ASM_LABEL_TRACK;
+            start.track = i;
+        }
+    }
+
+    listing.commands.reserve(d.commands.Size());
+    for (int i=0; i<d.commands.Size(); i++)
+        listing.commands.append(d.commands.Value(i));
+
+    std::sort(listing.commands.begin(), listing.commands.end(), [](const AsmCommand &a, const AsmCommand &b) {
+        return a.offset < b.offset;
+    });
+
+    //A jump into the middle of a command decodes the same bytes twice
+    for (int i=1; i<listing.commands.size(); i++)
+    {
+        const AsmCommand &previous = listing.commands[i - 1];
+
+        if (listing.commands[i].offset < previous.offset + previous.m4a.length)
+        {
+            QString msg = "Overlapping commands at 0x" + IntToHexQString(listing.commands[i].offset);
+            throw msg;
+        }
+    }
+
+    return listing;
+}
+
+//Decodes the commands from offset until the flow stops or reaches decoded ones.
+//PATT is followed right away to know the running status it returns with, GOTO
+//goes on in the same loop. Returns the running status at the end
+static quint8 DecodeFrom(Disassembly &d, quint32 offset, quint8 running, quint8 track, int depth)
+{
+    if (depth > ASM_MAX_JUMP_DEPTH)
+    {
+        QString msg = "Jumps nested too deep at 0x" + IntToHexQString(offset);
+        throw msg;
+    }
+
+    while (!d.commands.Contains(offset))
+    {
+        if (++d.count == M4A_MAX_COMMANDS)
+        {
+            QString msg = "Too many commands in the song at 0x" + IntToHexQString(offset);
+            throw msg;
+        }
+
+        AsmCommand c;
+
+        c.offset = offset;
+        c.m4a = M4aReadCommand(*d.rom, offset, running);
+        c.track = track;
+        c.label = ASM_LABEL_NONE;
+        d.commands.Insert(offset, c);
+        if (c.m4a.hasTarget)
+            d.jumps.append(c);
+
+        if (c.m4a.command >= M4A_VOICE)
+            running = c.m4a.command;
+        offset += c.m4a.length;
+
+        switch (c.m4a.command)
+        {
+        case M4A_FINE:
+        case M4A_PEND:
+            return running;
+        case M4A_XCMD:
+            if (M4aXcmdEndsTrack(c.m4a.args[0]))
+                return running;
+            break;
+        case M4A_GOTO:
+            //mid2agb ends tracks with GOTO and a FINE that is never played
+            if (offset < d.rom->Size() && d.rom->ReadByte(offset) == M4A_FINE && !d.commands.Contains(offset))
+                DecodeFrom(d, offset, running, track, depth);
+            offset = c.m4a.target;
+            break;
+        case M4A_REPT:
+            if (c.m4a.args[0] == 0)     //Forever, same as GOTO
+                offset = c.m4a.target;
+            else
+                DecodeFrom(d, c.m4a.target, running, track, depth + 1);
+            break;
+        case M4A_MEMACC:
+            if (c.m4a.hasTarget)
+                DecodeFrom(d, c.m4a.target, running, track, depth + 1);
+            break;
+        case M4A_PATT:
+        {
+            int exit;
+
+            if (!d.commands.Contains(c.m4a.target))
+            {
+                quint8 status = DecodeFrom(d, c.m4a.target, running, track, depth + 1);
+                d.patternExits.Insert(c.m4a.target, status);
+            }
+
+            exit = d.patternExits.IndexOf(c.m4a.target);
+            if (exit >= 0)
+                running = d.patternExits.Value(exit);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    return running;
+}
+
+//Patterns get their own label kind, a track start keeps its label
+static void LabelTarget(Disassembly &d, const AsmCommand &jump)
+{
+    int index = d.commands.IndexOf(jump.m4a.target);
+
+    if (index < 0)
+    {
+        QString msg = "Jump into a command at 0x" + IntToHexQString(jump.offset);
+        throw msg;
+    }
+
+    AsmCommand &target = d.commands.Value(index);
+    if (jump.m4a.command == M4A_PATT && target.label != ASM_LABEL_TRACK)
+        target.label = ASM_LABEL_PATTERN;
+    else if (target.label == ASM_LABEL_NONE)
+        target.label = ASM_LABEL_BRANCH;
+}
+
+//pret mus_*.s file, the .byte macro form mid2agb writes. Values are written
+//with the song's .equ names where mid2agb uses them, they assemble to the
+//same bytes the ROM has
+QString SongListingToAsm(const SongListing &listing, const QString &name, const QString &voiceGroup)
+{
+    QString out;
+    OffsetIndex<QString> labels;
+    QVector<int> branches(listing.tracks.size(), 0);
+    QVector<int> patterns(listing.tracks.size(), 0);
+
+    //mus_N_1, mus_N_1_B1 for jumps and mus_N_1_000 for patterns, numbered in ROM order
+    for (int i=0; i<listing.commands.size(); i++)
+    {
+        const AsmCommand &c = listing.commands[i];
+        QString track = name + "_" + IntToDecimalQString(c.track + 1);
+
+        if (c.label == ASM_LABEL_TRACK)
+            labels.Insert(c.offset, track);
+        else if (c.label == ASM_LABEL_BRANCH)
+            labels.Insert(c.offset, track + "_B" + IntToDecimalQString(++branches[c.track]));
+        else if (c.label == ASM_LABEL_PATTERN)
+            labels.Insert(c.offset, track + "_" + QString::number(patterns[c.track]++).rightJustified(3, '0'));
+    }
+
+    out.reserve(listing.commands.size() * 24 + 1024);
+
+    out += "\t.include \"MPlayDef.s\"\n\n";
+    out += "\t.equ\t" + name + "_grp, " + voiceGroup + "\n";
+    out += "\t.equ\t" + name + "_pri, " + IntToDecimalQString(listing.priority) + "\n";
+    if (listing.reverb & 0x80)
+        out += "\t.equ\t" + name + "_rev, reverb_set+" + IntToDecimalQString(listing.reverb & 0x7F) + "\n";
+    else
+        out += "\t.equ\t" + name + "_rev, " + IntToDecimalQString(listing.reverb) + "\n";
+    out += "\t.equ\t" + name + "_mvl, 127\n";
+    out += "\t.equ\t" + name + "_key, 0\n";
+    out += "\t.equ\t" + name + "_tbs, 1\n";
+    out += "\t.equ\t" + name + "_exg, 0\n";
+    out += "\t.equ\t" + name + "_cmp, 1\n\n";
+    out += "\t.section .rodata\n";
+    out += "\t.global\t" + name + "\n";
+    out += "\t.align\t2\n";
+
+    for (int i=0; i<listing.commands.size(); i++)
+    {
+        const AsmCommand &c = listing.commands[i];
+        QString line;
+
+        if (c.label == ASM_LABEL_TRACK)
+        {
+            QString title = " Track " + IntToDecimalQString(c.track + 1).rightJustified(2) + " ";
+            out += "\n@" + QString(22, '*') + title + QString(22, '*') + "@\n\n";
+        }
+
+        if (c.label != ASM_LABEL_NONE)
+            out += labels.Value(labels.IndexOf(c.offset)) + ":\n";
+
+        if (c.m4a.running)
+            line = "\t.byte\t\t\t";
+        else if (c.m4a.argCount == 0)
+            line = "\t.byte\t" + CommandName(c.m4a.command);
+        else
+            line = "\t.byte\t\t" + CommandName(c.m4a.command).leftJustified(6) + ", ";
+
+        //xwave and the 0x0D XCMD take a word, written as one
+        int byteArgs = c.m4a.argCount;
+        if (c.m4a.command == M4A_XCMD && c.m4a.argCount == 5)
+            byteArgs = 1;
+
+        for (int j=0; j<byteArgs; j++)
+            line += (j > 0 ? " , " : "") + ArgumentText(name, c, j);
+        out += line + "\n";
+
+        if (c.m4a.command == M4A_XCMD && c.m4a.argCount == 5)
+        {
+            quint32 word = c.m4a.args[1] | (c.m4a.args[2] << 8) | (c.m4a.args[3] << 16) | (quint32(c.m4a.args[4]) << 24);
+            out += "\t .word\t0x" + IntToHexQString(word) + "\n";
+        }
+
+        if (c.m4a.hasTarget)
+            out += "\t .word\t" + labels.Value(labels.IndexOf(c.m4a.target)) + "\n";
+    }
+
+    out += "\n@" + QString(54, '*') + "@\n";
+    out += "\t.align\t2\n\n";
+    out += name + ":\n";
+    out += "\t.byte\t" + IntToDecimalQString(listing.tracks.size()) + "\t@ NumTrks\n";
+    out += "\t.byte\t" + IntToDecimalQString(listing.blocks) + "\t@ NumBlks\n";
+    out += "\t.byte\t" + name + "_pri\t@ Priority\n";
+    out += "\t.byte\t" + name + "_rev\t@ Reverb.\n\n";
+    out += "\t.word\t" + name + "_grp\n\n";
+    for (int i=0; i<listing.tracks.size(); i++)
+        out += "\t.word\t" + labels.Value(labels.IndexOf(listing.tracks[i])) + "\n";
+    out += "\n\t.end\n";
+
+    return out;
+}
+
+//W00-W96, N01-N96 and the MPlayDef.s names of the others
+static QString CommandName(quint8 command)
+{
+    if (command >= M4A_WAIT_FIRST && command <= M4A_WAIT_LAST)
+        return "W" + QString::number(M4aCommandTicks(command)).rightJustified(2, '0');
+    if (command >= M4A_NOTE_FIRST)
+        return "N" + QString::number(M4aCommandTicks(command)).rightJustified(2, '0');
+
+    switch (command)
+    {
+    case M4A_FINE:      return "FINE";
+    case M4A_GOTO:      return "GOTO";
+    case M4A_PATT:      return "PATT";
+    case M4A_PEND:      return "PEND";
+    case M4A_REPT:      return "REPT";
+    case M4A_MEMACC:    return "MEMACC";
+    case M4A_PRIO:      return "PRIO";
+    case M4A_TEMPO:     return "TEMPO";
+    case M4A_KEYSH:     return "KEYSH";
+    case M4A_VOICE:     return "VOICE";
+    case M4A_VOL:       return "VOL";
+    case M4A_PAN:       return "PAN";
+    case M4A_BEND:      return "BEND";
+    case M4A_BENDR:     return "BENDR";
+    case M4A_LFOS:      return "LFOS";
+    case M4A_LFODL:     return "LFODL";
+    case M4A_MOD:       return "MOD";
+    case M4A_MODT:      return "MODT";
+    case M4A_TUNE:      return "TUNE";
+    case M4A_XCMD:      return "XCMD";
+    case M4A_EOT:       return "EOT";
+    case M4A_TIE:       return "TIE";
+    default:            return "0x" + IntToHexQString(command);
+    }
+}
+
+//Argument arg of the command as mid2agb writes it
+static QString ArgumentText(const QString &name, const AsmCommand &c, int arg)
+{
+    quint8 value = c.m4a.args[arg];
+    int centered = value - 0x40;
+
+    switch (c.m4a.command)
+    {
+    case M4A_TIE:
+    case M4A_EOT:
+        if (arg == 0)
+            return KeyName(value);
+        return "v" + QString::number(value).rightJustified(3, '0');
+    case M4A_KEYSH:
+        return name + "_key" + (qint8(value) < 0 ? "" : "+") + QString::number(qint8(value));
+    case M4A_TEMPO:
+        return QString::number(value * 2) + "*" + name + "_tbs/2";
+    case M4A_VOL:
+        return QString::number(value) + "*" + name + "_mvl/mxv";
+    case M4A_PAN:
+    case M4A_BEND:
+    case M4A_TUNE:
+        return QString("c_v") + (centered < 0 ? "" : "+") + QString::number(centered);
+    case M4A_XCMD:
+        if (arg == 0 && value == 0x08)
+            return "xIECV";
+        if (arg == 0 && value == 0x09)
+            return "xIECL";
+        return "0x" + IntToHexQString(value);
+    default:
+        break;
+    }
+
+    if (c.m4a.command >= M4A_NOTE_FIRST)
+    {
+        if (arg == 0)
+            return KeyName(value);
+        if (arg == 1)
+            return "v" + QString::number(value).rightJustified(3, '0');
+        if (value >= 1 && value <= 3)
+            return "gtp" + QString::number(value);
+    }
+
+    return QString::number(value);
+}
+
+//Cn3 is key 60
+static QString KeyName(quint8 key)
+{
+    int octave = key / 12 - 2;
+
+    return QString(noteNames[key % 12]) + (octave < 0 ? "M" + QString::number(-octave) : QString::number(octave));
+}
@@ -0,0 +1,566 @@
+#include "include/m4a_sequence.h"
+#include "include/binary_utils.h"
+#include "include/offset_index.h"
+#include <QAtomicInt>
+#include <QMutex>
+
+#define BLOCK_KEY       0x01    //Arguments a note, TIE or EOT has, the left out
+#define BLOCK_VELOCITY  0x02    //ones keep the last values of the track
+#define BLOCK_GATE      0x04
+
+struct CommandInfo {
+    quint8 kind;            //M4A_KIND_*
+    quint8 length;          //Ticks of a WAIT or a note
+};
+
+//Memory position reached by the main stream of a track, to resolve where GOTO goes
+struct TrackPosition {
+    quint32 offset;
+    quint32 tick;
+};
+
+//One command of a block, the arguments as they are in the ROM
+struct BlockCommand {
+    quint32 offset;
+    quint32 tick;           //Since the start of the block
+    quint8 command;
+    quint8 args[3];
+    quint8 present;         //BLOCK_* of notes, TIE and EOT
+};
+
+//Straight-line commands up to the one that changes the flow: a node of the
+//tracks' control-flow graph, its edges are next and target. Songs share
+//patterns and tracks, so blocks are decoded once per ROM offset and run
+struct TrackBlock {
+    quint32 offset;
+    bool usesEntryRunning;  //A byte before any command sets running status repeats entryRunning
+    quint8 entryRunning;
+    quint8 exitRunning;     //0 if no command in it has running status
+    QVector<BlockCommand> commands;
+    quint32 ticks;
+    quint8 end;             //M4A_KIND_FINE, GOTO, PATT, PEND or REPT
+    quint32 endOffset;      //Offset of that command
+    quint32 next;           //Offset right after it
+    quint32 target;         //GOTO, PATT and REPT
+    quint8 times;           //REPT count
+};
+
+static const CommandInfo *CommandTable();
+static void DecodeTrack(const RomView &rom, SongSequence &sequence, SequenceTrack &track);
+static TrackBlock FetchBlock(const RomView &rom, quint32 offset, quint8 running);
+static TrackBlock DecodeBlock(const RomView &rom, quint32 offset, quint8 running);
+static bool FollowGoto(const QVector<TrackPosition> &positions, const TrackBlock &block, SequenceTrack &track, quint32 &offset);
+static void AddEvent(SongSequence &sequence, quint32 tick, quint8 command, quint8 arg0, quint8 arg1, quint8 arg2);
+
+static OffsetIndex<TrackBlock> blockCache;     //Every block decoded in the run
+static QMutex blockMutex;
+static QAtomicInt blocksDecoded;
+static QAtomicInt blocksReused;
+
+//W00-W96 and N01-N96, lengths in ticks
+static const quint8 m4aLengths[] = {
+    0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24,
+    28, 30, 32, 36, 40, 42, 44, 48, 52, 54, 56, 60, 64, 66, 68, 72, 76, 78, 80, 84, 88, 90, 92, 96
+};
+
+//Decodes every track of the song at songHeader into one flat event array,
+//throws a QString if the header or a track can't be read
+SongSequence DecodeSongSequence(const RomView &rom, quint32 songHeader)
+{
+    SongSequence sequence;
+    quint8 trackCount = rom.ReadByte(songHeader);
+    quint32 first = 0xFFFFFFFF;
+    quint32 last = 0;
+
+    if (trackCount > M4A_MAX_TRACKS)
+    {
+        QString msg = "Bad track count \"" + IntToDecimalQString(trackCount) + "\"";
+        throw msg;
+    }
+
+    sequence.header = songHeader;
+    sequence.tracks.resize(trackCount);
+
+    RomSpan pointers = rom.ReadSpan(songHeader + M4A_TRACK_POINTERS_OFFSET, trackCount * 4);
+    for (int i=0; i<trackCount; i++)
+    {
+        sequence.tracks[i].offset = pointers.Pointer(i * 4);
+        first = qMin(first, sequence.tracks[i].offset);
+        last = qMax(last, sequence.tracks[i].offset);
+    }
+
+    //Tracks are usually stored one after the other and most commands are
+    //one or two bytes, their size is a good guess of the number of events
+    if (trackCount > 0)
+        sequence.events.reserve(qMin<quint32>(last - first, M4A_MAX_COMMANDS) + 64 * trackCount);
+
+    for (int i=0; i<trackCount; i++)
+        DecodeTrack(rom, sequence, sequence.tracks[i]);
+
+    return sequence;
+}
+
+//The cache is only valid for one ROM, ExtractROMSongData clears it
+void ClearSequenceCache()
+{
+    QMutexLocker locker(&blockMutex);
+    blockCache.Clear();
+}
+
+void ResetSequenceCacheStats()
+{
+    blocksDecoded.fetchAndStoreRelaxed(0);
+    blocksReused.fetchAndStoreRelaxed(0);
+}
+
+SequenceCacheStats GetSequenceCacheStats()
+{
+    SequenceCacheStats stats;
+
+    stats.decoded = blocksDecoded.loadAcquire();
+    stats.reused = blocksReused.loadAcquire();
+    return stats;
+}
+
+//One command and its arguments, the command formats the decoder and the
+//disassembler share. Optional arguments are bytes below 0x80, the end of the
+//ROM isn't one. Throws a QString if the byte isn't a command or repeats none
+M4aCommand M4aReadCommand(const RomView &rom, quint32 offset, quint8 running)
+{
+    M4aCommand c;
+    quint32 pos = offset;
+    quint8 byte = rom.ReadByte(pos);
+    int optional = 0;
+
+    c.argCount = 0;
+    c.hasTarget = false;
+    c.target = 0;
+    c.running = byte < 0x80;
+
+    if (c.running)
+    {
+        if (running == 0)
+        {
+            QString msg = "Argument without a command at 0x" + IntToHexQString(offset);
+            throw msg;
+        }
+        c.command = running;
+    }
+    else
+    {
+        c.command = byte;
+        pos++;
+    }
+
+    c.kind = CommandTable()[c.command].kind;
+
+    switch (c.kind)
+    {
+    case M4A_KIND_NOTE:
+        optional = 3;           //Key, velocity, gate time
+        break;
+    case M4A_KIND_TIE:
+        optional = 2;           //Key, velocity
+        break;
+    case M4A_KIND_EOT:
+        optional = 1;           //Key
+        break;
+    case M4A_KIND_WAIT:
+    case M4A_KIND_FINE:
+    case M4A_KIND_PEND:
+        break;
+    case M4A_KIND_GOTO:
+    case M4A_KIND_PATT:
+        c.hasTarget = true;
+        break;
+    case M4A_KIND_REPT:
+        c.args[c.argCount++] = rom.ReadByte(pos++);
+        c.hasTarget = true;
+        break;
+    case M4A_KIND_MEMACC:
+        for (int i=0; i<3; i++)     //Operation, address, data
+            c.args[c.argCount++] = rom.ReadByte(pos++);
+        c.hasTarget = c.args[0] >= M4A_MEMACC_FIRST_JUMP;
+        break;
+    case M4A_KIND_XCMD:
+    {
+        quint8 type = rom.ReadByte(pos++);
+
+        //The driver indexes gXcmdTable with the type, past it there's no handler
+        if (type > M4A_XCMD_0D)
+        {
+            QString msg = "Bad XCMD type 0x" + IntToHexQString(type) + " at 0x" + IntToHexQString(offset);
+            throw msg;
+        }
+
+        c.args[c.argCount++] = type;
+        for (int i=0; i<M4aXcmdArgumentLength(type); i++)
+            c.args[c.argCount++] = rom.ReadByte(pos++);
+        break;
+    }
+    case M4A_KIND_ARGUMENT:
+        c.args[c.argCount++] = rom.ReadByte(pos++);
+        break;
+    default:
+    {
+        QString msg = "Bad track command 0x" + IntToHexQString(c.command) +
+                " at 0x" + IntToHexQString(offset);
+        throw msg;
+    }
+    }
+
+    while (c.argCount < optional && pos < rom.Size() && rom.ReadByte(pos) < 0x80)
+        c.args[c.argCount++] = rom.ReadByte(pos++);
+
+    if (c.hasTarget)
+    {
+        c.target = rom.ReadPointer(pos);
+        pos += 4;
+    }
+
+    c.length = pos - offset;
+    return c;
+}
+
+//Ticks of a WAIT or a note, 0 for other commands
+quint8 M4aCommandTicks(quint8 command)
+{
+    return CommandTable()[command].length;
+}
+
+//Bytes after the XCMD type, only types up to M4A_XCMD_0D exist
+quint8 M4aXcmdArgumentLength(quint8 type)
+{
+    switch (type)
+    {
+    case M4A_XCMD_XXX:
+    case M4A_XCMD_XXX_3:
+        return 0;
+    case M4A_XCMD_XWAVE:
+    case M4A_XCMD_0D:
+        return 4;
+    case M4A_XCMD_0C:
+        return 2;
+    default:
+        return 1;
+    }
+}
+
+//ply_xxx jumps to ply_fine
+bool M4aXcmdEndsTrack(quint8 type)
+{
+    return type == M4A_XCMD_XXX || type == M4A_XCMD_XXX_3;
+}
+
+//256 entries, one per command byte
+static const CommandInfo *CommandTable()
+{
+    static CommandInfo table[256];
+    static bool ready = [] {
+        for (int i=0; i<256; i++)
+        {
+            table[i].kind = M4A_KIND_INVALID;
+            table[i].length = 0;
+        }
+
+        for (int i=M4A_WAIT_FIRST; i<=M4A_WAIT_LAST; i++)
+        {
+            table[i].kind = M4A_KIND_WAIT;
+            table[i].length = m4aLengths[i - M4A_WAIT_FIRST];
+        }
+
+        for (int i=M4A_NOTE_FIRST; i<=M4A_NOTE_LAST; i++)
+        {
+            table[i].kind = M4A_KIND_NOTE;
+            table[i].length = m4aLengths[i - M4A_NOTE_FIRST + 1];
+        }
+
+        table[M4A_FINE].kind = M4A_KIND_FINE;
+        table[M4A_GOTO].kind = M4A_KIND_GOTO;
+        table[M4A_PATT].kind = M4A_KIND_PATT;
+        table[M4A_PEND].kind = M4A_KIND_PEND;
+        table[M4A_REPT].kind = M4A_KIND_REPT;
+        table[M4A_MEMACC].kind = M4A_KIND_MEMACC;
+        table[M4A_XCMD].kind = M4A_KIND_XCMD;
+        table[M4A_EOT].kind = M4A_KIND_EOT;
+        table[M4A_TIE].kind = M4A_KIND_TIE;
+
+        const quint8 withArgument[] = {M4A_PRIO, M4A_TEMPO, M4A_KEYSH, M4A_VOICE, M4A_VOL, M4A_PAN, M4A_BEND,
+                                       M4A_BENDR, M4A_LFOS, M4A_LFODL, M4A_MOD, M4A_MODT, M4A_TUNE};
+        for (quint8 command : withArgument)
+            table[command].kind = M4A_KIND_ARGUMENT;
+
+        return true;
+    }();
+
+    Q_UNUSED(ready);
+    return table;
+}
+
+//Follows the track like the sound driver plays it until FINE or the GOTO that
+//loops it, a block at a time. PATT calls nest up to M4A_CALL_DEPTH, REPT keeps
+//one counter per track and MEMACC jumps are never taken, they depend on the
+//game's memory. The walk is a loop over the blocks, never a recursion, and
+//M4A_MAX_COMMANDS stops cycles that never reach a played command again
+static void DecodeTrack(const RomView &rom, SongSequence &sequence, SequenceTrack &track)
+{
+    QVector<TrackPosition> positions;
+    quint32 calls[M4A_CALL_DEPTH];
+    int depth = 0;
+    quint8 repeats = 0;
+    quint8 running = 0;         //Last command with running status
+    quint8 key = 60;
+    quint8 velocity = 127;
+    quint32 tick = 0;
+    quint32 offset = track.offset;
+    quint32 count = 0;
+    bool ended = false;
+
+    track.firstEvent = sequence.events.size();
+    track.loopTick = M4A_NO_LOOP;
+
+    while (!ended)
+    {
+        TrackBlock block = FetchBlock(rom, offset, running);
+
+        count += block.commands.size() + 1;
+        if (count >= M4A_MAX_COMMANDS)
+        {
+            QString msg = "Track at 0x" + IntToHexQString(track.offset) + " doesn't end";
+            throw msg;
+        }
+
+        for (int i=0; i<block.commands.size(); i++)
+        {
+            const BlockCommand &c = block.commands[i];
+
+            if (depth == 0)
+            {
+                TrackPosition position = {c.offset, tick + c.tick};
+                positions.append(position);
+            }
+
+            //Left out arguments keep the last ones of the track
+            if (c.present & BLOCK_KEY)
+                key = c.args[0];
+            if (c.present & BLOCK_VELOCITY)
+                velocity = c.args[1];
+
+            if (c.command >= M4A_NOTE_FIRST)
+            {
+                quint8 length = M4aCommandTicks(c.command) + ((c.present & BLOCK_GATE) ? c.args[2] : 0);
+                AddEvent(sequence, tick + c.tick, M4A_NOTE_FIRST, key, velocity, length);
+            }
+            else if (c.command == M4A_TIE)
+                AddEvent(sequence, tick + c.tick, M4A_TIE, key, velocity, 0);
+            else if (c.command == M4A_EOT)
+                AddEvent(sequence, tick + c.tick, M4A_EOT, key, 0, 0);
+            else if (c.command < M4A_WAIT_FIRST || c.command > M4A_WAIT_LAST)
+                AddEvent(sequence, tick + c.tick, c.command, c.args[0], c.args[1], c.args[2]);
+        }
+
+        tick += block.ticks;
+        if (block.exitRunning != 0)
+            running = block.exitRunning;
+
+        if (depth == 0)
+        {
+            TrackPosition position = {block.endOffset, tick};
+            positions.append(position);
+        }
+
+        offset = block.next;
+
+        switch (block.end)
+        {
+        case M4A_KIND_PATT:
+            if (depth < M4A_CALL_DEPTH)
+            {
+                calls[depth++] = block.next;
+                offset = block.target;
+            }
+            break;
+        case M4A_KIND_PEND:
+            if (depth > 0)
+                offset = calls[--depth];
+            break;
+        case M4A_KIND_REPT:
+            if (block.times == 0)   //Forever, same as GOTO
+                ended = FollowGoto(positions, block, track, offset);
+            else if (++repeats < block.times)
+                offset = block.target;
+            else
+                repeats = 0;
+            break;
+        case M4A_KIND_GOTO:
+            ended = FollowGoto(positions, block, track, offset);
+            break;
+        default:                    //FINE
+            ended = true;
+            break;
+        }
+    }
+
+    track.endTick = tick;
+    track.eventCount = sequence.events.size() - track.firstEvent;
+}
+
+//The block at offset, from the cache when it was decoded with the same running
+//status or doesn't depend on it. Only the lookups hold the lock: two songs
+//asking for the same new block both decode it and the first one is kept
+static TrackBlock FetchBlock(const RomView &rom, quint32 offset, quint8 running)
+{
+    int index;
+
+    {
+        QMutexLocker locker(&blockMutex);
+
+        index = blockCache.IndexOf(offset);
+        if (index >= 0)
+        {
+            const TrackBlock &cached = blockCache.Value(index);
+
+            if (!cached.usesEntryRunning || cached.entryRunning == running)
+            {
+                blocksReused.fetchAndAddRelaxed(1);
+                return cached;
+            }
+        }
+    }
+
+    TrackBlock block = DecodeBlock(rom, offset, running);
+    blocksDecoded.fetchAndAddRelaxed(1);
+
+    if (index < 0)
+    {
+        QMutexLocker locker(&blockMutex);
+        blockCache.Insert(offset, block);
+    }
+
+    return block;
+}
+
+//Commands from offset up to the first one that changes the flow
+static TrackBlock DecodeBlock(const RomView &rom, quint32 offset, quint8 running)
+{
+    TrackBlock block;
+    quint32 pos = offset;
+
+    block.offset = offset;
+    block.usesEntryRunning = false;
+    block.entryRunning = running;
+    block.exitRunning = 0;
+    block.ticks = 0;
+    block.target = 0;
+    block.times = 0;
+
+    for (;;)
+    {
+        if (block.commands.size() == M4A_MAX_COMMANDS)
+        {
+            QString msg = "Track block at 0x" + IntToHexQString(offset) + " doesn't end";
+            throw msg;
+        }
+
+        M4aCommand m = M4aReadCommand(rom, pos, running);
+        BlockCommand c = {pos, block.ticks, m.command, {0, 0, 0}, 0};
+
+        if (m.running && block.exitRunning == 0)
+            block.usesEntryRunning = true;
+
+        if (m.command >= M4A_VOICE)
+        {
+            running = m.command;
+            block.exitRunning = m.command;
+        }
+
+        block.end = m.kind;
+        block.endOffset = pos;
+        pos += m.length;
+
+        switch (m.kind)
+        {
+        case M4A_KIND_WAIT:
+            block.ticks += M4aCommandTicks(m.command);
+            break;
+        case M4A_KIND_NOTE:
+        case M4A_KIND_TIE:
+        case M4A_KIND_EOT:
+            for (int i=0; i<m.argCount; i++)
+            {
+                c.args[i] = m.args[i];
+                c.present |= 1 << i;
+            }
+            break;
+        case M4A_KIND_ARGUMENT:
+        case M4A_KIND_MEMACC:
+            for (int i=0; i<m.argCount; i++)
+                c.args[i] = m.args[i];
+            break;
+        case M4A_KIND_XCMD:
+            //Only the first byte of the longer arguments is kept
+            c.args[0] = m.args[0];
+            c.args[1] = m.argCount > 1 ? m.args[1] : 0;
+
+            //Played like FINE, the event is kept all the same
+            if (M4aXcmdEndsTrack(m.args[0]))
+            {
+                block.commands.append(c);
+                block.end = M4A_KIND_FINE;
+            }
+            break;
+        case M4A_KIND_PATT:
+        case M4A_KIND_GOTO:
+            block.target = m.target;
+            break;
+        case M4A_KIND_REPT:
+            block.times = m.args[0];
+            block.target = m.target;
+            break;
+        default:
+            break;
+        }
+
+        switch (block.end)
+        {
+        case M4A_KIND_FINE:
+        case M4A_KIND_GOTO:
+        case M4A_KIND_PATT:
+        case M4A_KIND_PEND:
+        case M4A_KIND_REPT:
+            block.next = pos;
+            return block;
+        default:
+            block.commands.append(c);
+            break;
+        }
+    }
+}
+
+//Jumps to the target of the block's GOTO, unless it goes back to a command
+//already played: that's the song loop and the end of the track. Returns
+//whether the track ended
+static bool FollowGoto(const QVector<TrackPosition> &positions, const TrackBlock &block, SequenceTrack &track, quint32 &offset)
+{
+    for (int i=0; i<positions.size(); i++)
+    {
+        if (positions[i].offset == block.target)
+        {
+            track.loopTick = positions[i].tick;
+            return true;
+        }
+    }
+
+    //Backwards into the middle of a command, nothing sensible to play
+    if (block.target <= block.next)
+        return true;
+
+    offset = block.target;
+    return false;
+}
+
+static void AddEvent(SongSequence &sequence, quint32 tick, quint8 command, quint8 arg0, quint8 arg1, quint8 arg2)
+{
+    SequenceEvent event = {tick, command, {arg0, arg1, arg2}};
+    sequence.events.append(event);
+}
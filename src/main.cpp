@@ -1,10 +1,18 @@
 #include "include/mainwindow.h"
+#include "include/cli.h"
+#include "include/rom_profiles.h"
+#include "include/sample_cache.h"
 
 #include <QApplication>
 
 int main(int argc, char *argv[])
 {
+    if (IsCommandLineInvocation(argc, argv))
+        return RunCommandLine(argc, argv);
+
     QApplication a(argc, argv);
+    LoadRomProfiles(QCoreApplication::applicationDirPath() + "/" + ROM_PROFILES_FILE);
+    InitSampleCache(DefaultSampleCachePath(), qint64(SAMPLE_CACHE_DEFAULT_SIZE_MB) * 1024 * 1024);
     MainWindow w;
     w.show();
     return a.exec();
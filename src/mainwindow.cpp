@@ -1,13 +1,17 @@
 #include "include/mainwindow.h"
 #include "include/binary_utils.h"
+#include "include/extraction_worker.h"
 #include "include/gba_music_utils.h"
 #include "include/pret_utils.h"
+#include "include/rom_profiles.h"
+#include "include/song_table_locator.h"
 #include "ui_mainwindow.h"
 #include <QMessageBox>
 #include <QFile>
 #include <QFileDialog>
 #include <QInputDialog>
 #include <QDir>
+#include <QThread>
 #include <limits.h>
 
 static QString getHexInputDialog(QWidget *parent, const QString &title, const QString &label,
@@ -17,6 +21,8 @@ static QString getHexInputDialog(QWidget *parent, const QString &title, const QS
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
+    , extractionThread(nullptr)
+    , extractionWorker(nullptr)
 {
     ui->setupUi(this);
     this->setFixedSize(400, 460);
@@ -24,6 +30,12 @@ MainWindow::MainWindow(QWidget *parent)
 
 MainWindow::~MainWindow()
 {
+    if (extractionThread != nullptr)
+    {
+        extractionWorker->Cancel();
+        extractionThread->quit();
+        extractionThread->wait();
+    }
     delete ui;
 }
 
@@ -45,28 +57,43 @@ void MainWindow::on_pushButton_File_clicked()
         {
             if (!CheckRomVersion())
             {
-                QMessageBox::StandardButton reply = QMessageBox::question(this,
-                                                            "Error",
-                                                            "Unkown ROM.\nWanna Manually Insert SongTable Offset?",
-                                                            QMessageBox::Yes|QMessageBox::No);
-                if (reply == QMessageBox::Yes)
+                QList<SongTableCandidate> candidates = LocateSongTables();
+
+                if (!candidates.isEmpty())
                 {
-                    QString offset;
-                    bool ok;
+                    romSongTableOffset = candidates.first().offset;
+                    romReady = true;
+                    unkownROM = true;
+                    QMessageBox::about(this,
+                                       "ROM Loaded",
+                                       "Unkown ROM Ready.\nSongTable found at 0x" +
+                                       IntToHexQString(romSongTableOffset));
+                }
+                else
+                {
+                    QMessageBox::StandardButton reply = QMessageBox::question(this,
+                                                                "Error",
+                                                                "Unkown ROM.\nWanna Manually Insert SongTable Offset?",
+                                                                QMessageBox::Yes|QMessageBox::No);
+                    if (reply == QMessageBox::Yes)
+                    {
+                        QString offset;
+                        bool ok;
 
-                    offset = getHexInputDialog(this, "SongTable Offset", "label", 0, 0, 0x1FFFFFF, 4, &ok);
+                        offset = getHexInputDialog(this, "SongTable Offset", "label", 0, 0, 0x1FFFFFF, 4, &ok);
 
-                    if (ok)
-                    {
-                        quint32 of;
-
-                        romSongTableOffset = offset.toUInt(&ok, 16);
-                        of = romSongTableOffset;
-                        romReady = true;
-                        unkownROM = true;
-                        QMessageBox::about(this,
-                                           "ROM Loaded",
-                                           "Unkown ROM Ready.");
+                        if (ok)
+                        {
+                            quint32 of;
+
+                            romSongTableOffset = offset.toUInt(&ok, 16);
+                            of = romSongTableOffset;
+                            romReady = true;
+                            unkownROM = true;
+                            QMessageBox::about(this,
+                                               "ROM Loaded",
+                                               "Unkown ROM Ready.");
+                        }
                     }
                 }
             }
@@ -77,8 +104,10 @@ void MainWindow::on_pushButton_File_clicked()
                 QMessageBox::about(this,
                                    "ROM Loaded",
                                    "ROM: " +
-                                   ROM_CODES[romType] + ": " +
-                                   ROM_NAMES[romType]);
+                                   romProfile->code + ": " +
+                                   romProfile->name + "\n" +
+                                   RomDumpStatusQString(romDumpStatus) +
+                                   " (CRC32 " + IntToHexQString(romCrc32) + ")");
             }
         }
     }
@@ -106,20 +135,74 @@ void MainWindow::on_pushButton_Extract_clicked()
                                                          "Choose a Folder to Extract the Data:",
                                                          QDir::homePath()) + "/music_data";
 
-    this->ui->pushButton_Extract->setEnabled(false);
-    this->ui->progressBar->setEnabled(true);
+    SetExtracting(true);
     this->ui->progressBar->setValue(0);
 
-    ExtractROMSongData(this->ui->spinBox_FirstSong->value(),
-                       this->ui->spinBox_LastSong->value(),
-                       this);
+    extractionThread = new QThread(this);
+    extractionWorker = new ExtractionWorker(this->ui->spinBox_FirstSong->value(),
+                                            this->ui->spinBox_LastSong->value());
+    extractionWorker->moveToThread(extractionThread);
 
-    QMessageBox::about(this,
-                       "Extraction Completed",
-                       "All music data has been successfully extracted\n"
-                       "at \"" + OUTPUT_DIRECTORY + "\"");
+    connect(extractionThread, &QThread::started, extractionWorker, &ExtractionWorker::Run);
+    connect(extractionWorker, &ExtractionWorker::Progress, this, &MainWindow::SetPercentage);
+    connect(extractionWorker, &ExtractionWorker::Finished, this, &MainWindow::ExtractionFinished);
+    connect(extractionThread, &QThread::finished, extractionWorker, &QObject::deleteLater);
+
+    extractionThread->start();
+}
 
-    this->ui->pushButton_Extract->setEnabled(true);
+void MainWindow::on_pushButton_Cancel_clicked()
+{
+    if (extractionWorker != nullptr)
+    {
+        this->ui->pushButton_Cancel->setEnabled(false);
+        extractionWorker->Cancel();
+    }
+}
+
+void MainWindow::ExtractionFinished(int result)
+{
+    extractionThread->quit();
+    extractionThread->wait();
+    extractionThread->deleteLater();
+    extractionThread = nullptr;
+    extractionWorker = nullptr;
+
+    SetExtracting(false);
+
+    switch (result)
+    {
+    case EXTRACTION_SUCCESS:
+        QMessageBox::about(this,
+                           "Extraction Completed",
+                           "All music data has been successfully extracted\n"
+                           "at \"" + OUTPUT_DIRECTORY + "\"");
+        break;
+
+    case EXTRACTION_CANCELLED:
+        this->ui->progressBar->setValue(0);
+        QMessageBox::about(this,
+                           "Extraction Cancelled",
+                           "Extraction cancelled, no files were written.");
+        break;
+
+    default:
+        QMessageBox::critical(this,
+                              "Error",
+                              "Some files couldn't be written at \"" + OUTPUT_DIRECTORY + "\"");
+        break;
+    }
+}
+
+//Locks the ROM and pret selection while the worker reads the global data
+void MainWindow::SetExtracting(bool extracting)
+{
+    this->ui->pushButton_File->setEnabled(!extracting);
+    this->ui->pushButton_Folder->setEnabled(!extracting);
+    this->ui->groupBox_Config->setEnabled(!extracting);
+    this->ui->pushButton_Extract->setEnabled(!extracting);
+    this->ui->pushButton_Cancel->setEnabled(extracting);
+    this->ui->progressBar->setEnabled(true);
 }
 
 void MainWindow::UpdateRomLabels(bool unkown){
@@ -129,8 +212,8 @@ void MainWindow::UpdateRomLabels(bool unkown){
     this->ui->label_rsongNum->setText(IntToDecimalQString(romSongTableSize));
 
     if (!unkown)
-        this->ui->label_rversion->setText(ROM_CODES[romType]
-                                          + " - " + ROM_NAMES[romType]);
+        this->ui->label_rversion->setText(romProfile->code
+                                          + " - " + romProfile->name);
     else
         this->ui->label_rversion->setText("UNKR - Unkown ROM");
 }
@@ -176,7 +259,7 @@ void MainWindow::EnableExtract()
     }
 }
 
-void MainWindow::SetPercentage(quint8 percentage)
+void MainWindow::SetPercentage(int percentage)
 {
     this->ui->progressBar->setValue(percentage);
 }
@@ -0,0 +1,256 @@
+#include "include/midi_writer.h"
+
+#define MIDI_NOTE_OFF       0x80
+#define MIDI_NOTE_ON        0x90
+#define MIDI_CONTROL        0xB0
+#define MIDI_PROGRAM        0xC0
+#define MIDI_PITCH_BEND     0xE0
+#define MIDI_META           0xFF
+#define MIDI_META_MARKER    0x06
+#define MIDI_META_END       0x2F
+#define MIDI_META_TEMPO     0x51
+
+//Controllers mid2agb turns back into m4a commands
+#define MIDI_CC_MOD         0x01
+#define MIDI_CC_VOL         0x07
+#define MIDI_CC_PAN         0x0A
+#define MIDI_CC_BENDR       0x14
+#define MIDI_CC_LFOS        0x15
+#define MIDI_CC_MODT        0x16
+#define MIDI_CC_TUNE        0x18
+#define MIDI_CC_LFODL       0x1A
+
+struct PendingNote {
+    quint32 tick;
+    quint8 key;
+};
+
+//Delta times are relative to the last event written in the track
+struct MidiTrack {
+    QByteArray data;
+    quint32 lastTick;
+    quint8 channel;
+    QVector<PendingNote> notes;     //Note offs not written yet
+};
+
+static void WriteTrack(QByteArray &out, const SongSequence &sequence, int index, bool loopMarkers);
+static void WriteNoteOffs(MidiTrack &track, quint32 tick);
+static void WriteEvent(MidiTrack &track, quint32 tick, quint8 status, quint8 data1, quint8 data2);
+static void WriteShortEvent(MidiTrack &track, quint32 tick, quint8 status, quint8 data1);
+static void WriteMeta(MidiTrack &track, quint32 tick, quint8 type, const char *data, int length);
+static void WriteDelta(MidiTrack &track, quint32 tick);
+static void WriteVarLen(QByteArray &out, quint32 value);
+static void WriteBigEndian(QByteArray &out, quint32 value, int bytes);
+static quint8 ShiftKey(quint8 key, qint8 shift);
+
+//Standard MIDI File (format 1, one MIDI track and channel per m4a track) the
+//way mid2agb reads it back: m4a ticks at MIDI_TICKS_PER_BEAT, the song loop as
+//"[" and "]" markers and the m4a commands as their controllers
+QByteArray SequenceToMidi(const SongSequence &sequence)
+{
+    QByteArray out;
+    bool loopMarkers = true;
+
+    out.reserve(14 + sequence.tracks.size() * 8 + sequence.events.size() * 6);
+
+    out.append("MThd", 4);
+    WriteBigEndian(out, 6, 4);
+    WriteBigEndian(out, 1, 2);
+    WriteBigEndian(out, sequence.tracks.size(), 2);
+    WriteBigEndian(out, MIDI_TICKS_PER_BEAT, 2);
+
+    //The first looping track carries the markers
+    for (int i=0; i<sequence.tracks.size(); i++)
+    {
+        bool loops = sequence.tracks[i].loopTick != M4A_NO_LOOP;
+
+        WriteTrack(out, sequence, i, loopMarkers && loops);
+        loopMarkers = loopMarkers && !loops;
+    }
+
+    return out;
+}
+
+static void WriteTrack(QByteArray &out, const SongSequence &sequence, int index, bool loopMarkers)
+{
+    const SequenceTrack &info = sequence.tracks[index];
+    MidiTrack track;
+    bool loopStarted = false;
+    qint8 keyShift = 0;
+
+    track.lastTick = 0;
+    track.channel = index & 0x0F;
+    track.data.reserve(info.eventCount * 6 + 32);
+
+    for (quint32 i=info.firstEvent; i<info.firstEvent + info.eventCount; i++)
+    {
+        const SequenceEvent &event = sequence.events[i];
+
+        if (loopMarkers && !loopStarted && event.tick >= info.loopTick)
+        {
+            WriteNoteOffs(track, info.loopTick);
+            WriteMeta(track, info.loopTick, MIDI_META_MARKER, MIDI_LOOP_START_MARKER, 1);
+            loopStarted = true;
+        }
+
+        WriteNoteOffs(track, event.tick);
+
+        switch (event.command)
+        {
+        case M4A_NOTE_FIRST:
+        {
+            PendingNote note = {event.tick + event.args[2], ShiftKey(event.args[0], keyShift)};
+
+            WriteEvent(track, event.tick, MIDI_NOTE_ON, note.key, event.args[1]);
+            track.notes.append(note);
+            break;
+        }
+        case M4A_TIE:
+            WriteEvent(track, event.tick, MIDI_NOTE_ON, ShiftKey(event.args[0], keyShift), event.args[1]);
+            break;
+        case M4A_EOT:
+            WriteEvent(track, event.tick, MIDI_NOTE_OFF, ShiftKey(event.args[0], keyShift), 0);
+            break;
+        case M4A_KEYSH:
+            keyShift = qint8(event.args[0]);
+            break;
+        case M4A_VOICE:
+            WriteShortEvent(track, event.tick, MIDI_PROGRAM, event.args[0]);
+            break;
+        case M4A_VOL:
+            WriteEvent(track, event.tick, MIDI_CONTROL, MIDI_CC_VOL, event.args[0]);
+            break;
+        case M4A_PAN:
+            WriteEvent(track, event.tick, MIDI_CONTROL, MIDI_CC_PAN, event.args[0]);
+            break;
+        case M4A_BEND:
+            WriteEvent(track, event.tick, MIDI_PITCH_BEND, 0, event.args[0]);
+            break;
+        case M4A_BENDR:
+            WriteEvent(track, event.tick, MIDI_CONTROL, MIDI_CC_BENDR, event.args[0]);
+            break;
+        case M4A_LFOS:
+            WriteEvent(track, event.tick, MIDI_CONTROL, MIDI_CC_LFOS, event.args[0]);
+            break;
+        case M4A_LFODL:
+            WriteEvent(track, event.tick, MIDI_CONTROL, MIDI_CC_LFODL, event.args[0]);
+            break;
+        case M4A_MOD:
+            WriteEvent(track, event.tick, MIDI_CONTROL, MIDI_CC_MOD, event.args[0]);
+            break;
+        case M4A_MODT:
+            WriteEvent(track, event.tick, MIDI_CONTROL, MIDI_CC_MODT, event.args[0]);
+            break;
+        case M4A_TUNE:
+            WriteEvent(track, event.tick, MIDI_CONTROL, MIDI_CC_TUNE, event.args[0]);
+            break;
+        case M4A_TEMPO:
+            //The argument is half the BPM
+            if (event.args[0] > 0)
+            {
+                quint32 usPerBeat = 60000000 / (event.args[0] * 2);
+                char tempo[3] = {char(usPerBeat >> 16), char(usPerBeat >> 8), char(usPerBeat)};
+                WriteMeta(track, event.tick, MIDI_META_TEMPO, tempo, 3);
+            }
+            break;
+        default:    //PRIO, MEMACC and XCMD have no MIDI equivalent
+            break;
+        }
+    }
+
+    if (loopMarkers && !loopStarted)
+    {
+        WriteNoteOffs(track, info.loopTick);
+        WriteMeta(track, info.loopTick, MIDI_META_MARKER, MIDI_LOOP_START_MARKER, 1);
+    }
+
+    WriteNoteOffs(track, info.endTick);
+
+    if (loopMarkers)
+        WriteMeta(track, info.endTick, MIDI_META_MARKER, MIDI_LOOP_END_MARKER, 1);
+
+    //Notes still playing at the end are cut where they'd stop
+    WriteNoteOffs(track, 0xFFFFFFFF);
+    WriteMeta(track, qMax(track.lastTick, info.endTick), MIDI_META_END, nullptr, 0);
+
+    out.append("MTrk", 4);
+    WriteBigEndian(out, track.data.size(), 4);
+    out.append(track.data.constData(), track.data.size());
+}
+
+//Note offs due up to tick, in tick order
+static void WriteNoteOffs(MidiTrack &track, quint32 tick)
+{
+    while (!track.notes.isEmpty())
+    {
+        int first = 0;
+
+        for (int i=1; i<track.notes.size(); i++)
+            if (track.notes[i].tick < track.notes[first].tick)
+                first = i;
+
+        if (track.notes[first].tick > tick)
+            return;
+
+        WriteEvent(track, track.notes[first].tick, MIDI_NOTE_OFF, track.notes[first].key, 0);
+        track.notes[first] = track.notes.last();
+        track.notes.removeLast();
+    }
+}
+
+static void WriteEvent(MidiTrack &track, quint32 tick, quint8 status, quint8 data1, quint8 data2)
+{
+    WriteDelta(track, tick);
+    track.data.append(char(status | track.channel));
+    track.data.append(char(data1 & 0x7F));
+    track.data.append(char(data2 & 0x7F));
+}
+
+static void WriteShortEvent(MidiTrack &track, quint32 tick, quint8 status, quint8 data1)
+{
+    WriteDelta(track, tick);
+    track.data.append(char(status | track.channel));
+    track.data.append(char(data1 & 0x7F));
+}
+
+static void WriteMeta(MidiTrack &track, quint32 tick, quint8 type, const char *data, int length)
+{
+    WriteDelta(track, tick);
+    track.data.append(char(MIDI_META));
+    track.data.append(char(type));
+    WriteVarLen(track.data, length);
+    if (length > 0)
+        track.data.append(data, length);
+}
+
+static void WriteDelta(MidiTrack &track, quint32 tick)
+{
+    WriteVarLen(track.data, tick - track.lastTick);
+    track.lastTick = tick;
+}
+
+static void WriteVarLen(QByteArray &out, quint32 value)
+{
+    char bytes[5];
+    int count = 0;
+
+    do {
+        bytes[count++] = char(value & 0x7F);
+        value >>= 7;
+    } while (value);
+
+    while (count > 1)
+        out.append(char(bytes[--count] | 0x80));
+    out.append(bytes[0]);
+}
+
+static void WriteBigEndian(QByteArray &out, quint32 value, int bytes)
+{
+    for (int i=bytes-1; i>=0; i--)
+        out.append(char(value >> (8 * i)));
+}
+
+static quint8 ShiftKey(quint8 key, qint8 shift)
+{
+    return quint8(qBound(0, key + shift, 127));
+}
@@ -0,0 +1,164 @@
+#include "include/resampler.h"
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <xmmintrin.h>
+#define RESAMPLE_SSE
+#endif
+
+#define RESAMPLE_PAD (RESAMPLE_TAPS / 2)
+#define RESAMPLE_PI 3.14159265358979323846
+
+static QVector<float> BuildKernel(double cutoff);
+static QVector<float> ExtendSamples(const qint8 *samples, quint32 length, qint32 loopStart);
+static QVector<float> ExtendLoop(const qint8 *samples, quint32 length, quint32 loopStart);
+static qint8 Interpolate(const QVector<float> &extended, const QVector<float> &kernel, double pos);
+static float DotProduct(const float *samples, const float *taps);
+
+//Windowed sinc resampler with a tabulated (polyphase) kernel. When the rate goes
+//down the kernel cutoff goes down with it so nothing aliases.
+//A looped sample keeps a whole number of samples in its loop: the head is
+//resampled at the exact ratio and the loop at the closest one that tiles, read
+//from a periodic copy of the loop so its last samples blend into its first ones
+ResampledPcm ResamplePcm(const qint8 *samples, quint32 length, qint32 loopStart, double fromRate, double toRate)
+{
+    ResampledPcm out;
+    bool loops = loopStart >= 0 && quint32(loopStart) < length;
+
+    out.loopStart = loops ? loopStart : RESAMPLE_NO_LOOP;
+
+    if (length == 0 || fromRate <= 0 || toRate <= 0)
+    {
+        out.samples.resize(length);
+        for (quint32 i=0; i<length; i++)
+            out.samples[i] = samples[i];
+        return out;
+    }
+
+    double step = fromRate / toRate;
+    QVector<float> kernel = BuildKernel(qMin(1.0, toRate / fromRate));
+    QVector<float> extended = ExtendSamples(samples, length, out.loopStart);
+
+    if (!loops)
+    {
+        out.samples.resize(qMax(1, qRound(length / step)));
+
+        for (int k=0; k<out.samples.size(); k++)
+            out.samples[k] = Interpolate(extended, kernel, k * step);
+
+        return out;
+    }
+
+    quint32 loopLength = length - loopStart;
+    int newLoopStart = qRound(loopStart / step);
+    int newLoopLength = qMax(1, qRound(loopLength / step));
+    double loopStep = double(loopLength) / newLoopLength;
+    QVector<float> loop = ExtendLoop(samples, length, loopStart);
+
+    out.loopStart = newLoopStart;
+    out.samples.resize(newLoopStart + newLoopLength);
+
+    for (int k=0; k<newLoopStart; k++)
+        out.samples[k] = Interpolate(extended, kernel, k * step);
+
+    for (int k=0; k<newLoopLength; k++)
+        out.samples[newLoopStart + k] = Interpolate(loop, kernel, k * loopStep);
+
+    return out;
+}
+
+//RESAMPLE_PHASES rows of RESAMPLE_TAPS taps, row p is the kernel for a position
+//p / RESAMPLE_PHASES past a sample. Blackman window, each row sums to 1
+static QVector<float> BuildKernel(double cutoff)
+{
+    QVector<float> kernel(RESAMPLE_PHASES * RESAMPLE_TAPS);
+
+    for (int p=0; p<RESAMPLE_PHASES; p++)
+    {
+        double frac = double(p) / RESAMPLE_PHASES;
+        double taps[RESAMPLE_TAPS];
+        double sum = 0;
+
+        for (int t=0; t<RESAMPLE_TAPS; t++)
+        {
+            double x = t - (RESAMPLE_PAD - 1) - frac;
+            double sinc = x == 0 ? 1 : std::sin(RESAMPLE_PI * cutoff * x) / (RESAMPLE_PI * cutoff * x);
+            double window = std::fabs(x) >= RESAMPLE_PAD ? 0 :
+                    0.42 + 0.5 * std::cos(RESAMPLE_PI * x / RESAMPLE_PAD) + 0.08 * std::cos(2 * RESAMPLE_PI * x / RESAMPLE_PAD);
+
+            taps[t] = cutoff * sinc * window;
+            sum += taps[t];
+        }
+
+        for (int t=0; t<RESAMPLE_TAPS; t++)
+            kernel[p * RESAMPLE_TAPS + t] = float(taps[t] / sum);
+    }
+
+    return kernel;
+}
+
+//Samples as floats with RESAMPLE_PAD silent samples before them and, after them,
+//the loop repeated (or silence) so the kernel never needs a bounds check
+static QVector<float> ExtendSamples(const qint8 *samples, quint32 length, qint32 loopStart)
+{
+    QVector<float> extended(length + 2 * RESAMPLE_PAD + 1, 0.0f);
+
+    for (quint32 i=0; i<length; i++)
+        extended[RESAMPLE_PAD + i] = samples[i];
+
+    if (loopStart != RESAMPLE_NO_LOOP)
+        for (int i=0; i<RESAMPLE_PAD + 1; i++)
+            extended[RESAMPLE_PAD + length + i] = samples[loopStart + i % (length - loopStart)];
+
+    return extended;
+}
+
+//The loop alone, repeated on both sides, as the sampler hears it once it's looping
+static QVector<float> ExtendLoop(const qint8 *samples, quint32 length, quint32 loopStart)
+{
+    qint64 loopLength = length - loopStart;
+    QVector<float> extended(loopLength + 2 * RESAMPLE_PAD + 1);
+
+    for (int i=0; i<extended.size(); i++)
+        extended[i] = samples[loopStart + ((i - RESAMPLE_PAD) % loopLength + loopLength) % loopLength];
+
+    return extended;
+}
+
+//Resampled value at input position pos (pos 0 is the first sample)
+static qint8 Interpolate(const QVector<float> &extended, const QVector<float> &kernel, double pos)
+{
+    int index = int(pos);
+    int phase = qRound((pos - index) * RESAMPLE_PHASES);
+
+    if (phase == RESAMPLE_PHASES)
+    {
+        index++;
+        phase = 0;
+    }
+
+    float value = DotProduct(extended.constData() + index + 1, kernel.constData() + phase * RESAMPLE_TAPS);
+
+    return qint8(qBound(-128, int(std::lround(value)), 127));
+}
+
+static float DotProduct(const float *samples, const float *taps)
+{
+#ifdef RESAMPLE_SSE
+    __m128 sum = _mm_mul_ps(_mm_loadu_ps(samples), _mm_loadu_ps(taps));
+
+    for (int t=4; t<RESAMPLE_TAPS; t += 4)
+        sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(samples + t), _mm_loadu_ps(taps + t)));
+
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 0x55));
+    return _mm_cvtss_f32(sum);
+#else
+    float sum = 0;
+
+    for (int t=0; t<RESAMPLE_TAPS; t++)
+        sum += samples[t] * taps[t];
+
+    return sum;
+#endif
+}
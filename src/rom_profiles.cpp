@@ -0,0 +1,175 @@
+#include "include/rom_profiles.h"
+#include <QFile>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QtEndian>
+
+#define MAX_PROFILE_CRCS 4
+
+struct BuiltinRomProfile {
+    const char *code;
+    const char *name;
+    quint32 songTablePointer;
+    quint32 songTablePointerAlt;
+    quint32 crc32[MAX_PROFILE_CRCS];    //Zero terminated
+};
+
+//Fallback when no profile file is found or it doesn't list a game
+static const BuiltinRomProfile BUILTIN_ROM_PROFILES[] = {
+    {"AXVE", "Ruby [Eng]",          0x1DDF20, 0x1DDF20, {0xF0815EE7}},
+    {"BPRE", "Fire Red [Eng]",      0x1DD11C, 0x1DD11C, {0xDD88761C, 0x84EE4776}},
+    {"BPEE", "Emerald [Eng]",       0x2E0158, 0x2E0158, {0x1F1C08FB}},
+    {"AXVS", "Rubí [Esp]",          0x1E2C30, 0x1E2C64, {0}},
+    {"BPRS", "Rojo Fuego [Esp]",    0x1DCC50, 0x1DCC84, {0}},
+    {"BPES", "Esmeralda [Esp]",     0x2E78E0, 0x2E7918, {0}},
+    {"AXVJ", "Ruby [Jap]",          0x1AE9B8, 0x1AE9EC, {0}},
+    {"BPRJ", "Fire Red [Jap]",      0x1C10D8, 0x1C110C, {0}},
+    {"BPEJ", "Emerald [Jap]",       0x28E6E0, 0x28E714, {0}},
+    {"AFEJ", "FE 6 [Eng]",          0x003748, 0x01545C, {0}},
+    {"AE7E", "FE 7 [Eng]",          0x003F50, 0x014DE8, {0}},
+    {"BE8E", "FE 8 [Eng]",          0x0028BC, 0x014B80, {0}},
+    {"BZ6P", "Final Fantasy VI",    0x134A50, 0x134A84, {0}}
+};
+
+static QHash<quint32, RomProfile> &Profiles();
+static quint32 GameCodeKey(QString code);
+static bool ReadProfileNumber(const QJsonValue &value, quint32 *number);
+
+//Loads a JSON profile file, its entries replace the built-in ones with the same code.
+//[{"code": "BPEE", "name": "Emerald [Eng]", "songTablePointer": "0x2E0158",
+//  "songTablePointerAlt": "0x2E0158", "crc32": ["0x1F1C08FB"]}, ...]
+bool LoadRomProfiles(QString filePath)
+{
+    QFile f(filePath);
+
+    if (!f.open(QIODevice::ReadOnly))
+        return false;
+
+    QJsonDocument doc = QJsonDocument::fromJson(f.readAll());
+    f.close();
+
+    if (!doc.isArray())
+        return false;
+
+    QJsonArray entries = doc.array();
+
+    for (int i=0; i<entries.size(); i++)
+    {
+        QJsonObject entry = entries[i].toObject();
+        QJsonArray crcs = entry["crc32"].toArray();
+        RomProfile profile;
+
+        profile.code = entry["code"].toString();
+        profile.name = entry["name"].toString();
+
+        if (GameCodeKey(profile.code) == 0 ||
+                !ReadProfileNumber(entry["songTablePointer"], &profile.songTablePointer))
+            continue;
+
+        if (!ReadProfileNumber(entry["songTablePointerAlt"], &profile.songTablePointerAlt))
+            profile.songTablePointerAlt = profile.songTablePointer;
+
+        for (int j=0; j<crcs.size(); j++)
+        {
+            quint32 crc;
+            if (ReadProfileNumber(crcs[j], &crc))
+                profile.crc32.append(crc);
+        }
+
+        Profiles().insert(GameCodeKey(profile.code), profile);
+    }
+
+    return true;
+}
+
+//Looks up the profile of the game code word read at ROM_HEADER_OFFSET
+const RomProfile *FindRomProfile(quint32 gameCode)
+{
+    QHash<quint32, RomProfile>::const_iterator it = Profiles().constFind(gameCode);
+
+    if (it == Profiles().constEnd())
+        return nullptr;
+
+    return &it.value();
+}
+
+//Checks the ROM CRC-32 against the clean dumps known for its profile
+quint8 VerifyRomDump(const RomProfile *profile, quint32 crc)
+{
+    if (profile == nullptr || profile->crc32.isEmpty())
+        return ROM_DUMP_UNVERIFIED;
+
+    if (profile->crc32.contains(crc))
+        return ROM_DUMP_CLEAN;
+
+    return ROM_DUMP_MODIFIED;
+}
+
+QString RomDumpStatusQString(quint8 status)
+{
+    switch (status)
+    {
+    case ROM_DUMP_CLEAN:
+        return "Clean dump";
+    case ROM_DUMP_MODIFIED:
+        return "Modified ROM or unknown revision";
+    default:
+        return "Unverified dump";
+    }
+}
+
+//Profiles by game code, filled with the built-in table on first use
+static QHash<quint32, RomProfile> &Profiles()
+{
+    static QHash<quint32, RomProfile> profiles = [] {
+        QHash<quint32, RomProfile> builtin;
+
+        for (uint i=0; i < sizeof(BUILTIN_ROM_PROFILES)/sizeof(BUILTIN_ROM_PROFILES[0]); i++)
+        {
+            RomProfile profile;
+
+            profile.code = BUILTIN_ROM_PROFILES[i].code;
+            profile.name = BUILTIN_ROM_PROFILES[i].name;
+            profile.songTablePointer = BUILTIN_ROM_PROFILES[i].songTablePointer;
+            profile.songTablePointerAlt = BUILTIN_ROM_PROFILES[i].songTablePointerAlt;
+
+            for (int j=0; j<MAX_PROFILE_CRCS && BUILTIN_ROM_PROFILES[i].crc32[j] != 0; j++)
+                profile.crc32.append(BUILTIN_ROM_PROFILES[i].crc32[j]);
+
+            builtin.insert(GameCodeKey(profile.code), profile);
+        }
+
+        return builtin;
+    }();
+
+    return profiles;
+}
+
+//Game code as the little-endian word stored in the ROM header, 0 if invalid
+static quint32 GameCodeKey(QString code)
+{
+    QByteArray latin = code.toLatin1();
+
+    if (latin.size() != 4)
+        return 0;
+
+    return qFromLittleEndian<quint32>(reinterpret_cast<const uchar*>(latin.constData()));
+}
+
+//Profile numbers are either JSON numbers or "0x" prefixed strings
+static bool ReadProfileNumber(const QJsonValue &value, quint32 *number)
+{
+    bool ok = false;
+
+    if (value.isString())
+        *number = value.toString().toUInt(&ok, 0);
+    else if (value.isDouble())
+    {
+        *number = static_cast<quint32>(value.toDouble());
+        ok = true;
+    }
+
+    return ok;
+}
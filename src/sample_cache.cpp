@@ -0,0 +1,218 @@
+#include "include/sample_cache.h"
+#include "include/binary_utils.h"
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QThread>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_LINUX
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#endif
+
+//Finished .aif/.wav files shared by every extraction on the machine, named after
+//the hash of the ROM sample, the converter version, the base note and a variant
+//(output options such as the rate, ending with the file extension).
+//Entries are written to a temp file and renamed, so other jobs never see
+//a partial one, and they are evicted by modification time (LRU)
+
+static QString EntryPath(Hash128 hash, quint8 baseNote, QString variant);
+static bool CloneFile(QString source, QString dest);
+static bool ReflinkFile(QString source, QString dest);
+static void TouchFile(QString path);
+
+static QString cacheDir;
+static qint64 cacheMaxSize;
+static QAtomicInt hits;
+static QAtomicInt misses;
+static QAtomicInt stored;
+static QAtomicInt evicted;
+
+QString DefaultSampleCachePath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation) + "/gba2pmd/samples";
+}
+
+//An empty path disables the cache
+bool InitSampleCache(QString path, qint64 maxSize)
+{
+    cacheDir = "";
+    cacheMaxSize = maxSize;
+
+    if (path.isEmpty() || !QDir().mkpath(path))
+        return false;
+
+    cacheDir = path;
+    return true;
+}
+
+void CloseSampleCache()
+{
+    cacheDir = "";
+}
+
+bool IsSampleCacheEnabled()
+{
+    return !cacheDir.isEmpty();
+}
+
+//Copies a cached sample file to dest, false if it isn't cached
+bool FetchCachedSample(Hash128 hash, quint8 baseNote, QString variant, QString dest)
+{
+    if (!IsSampleCacheEnabled())
+        return false;
+
+    QString entry = EntryPath(hash, baseNote, variant);
+
+    //Another job may evict it at any time, a failed clone is just a miss
+    if (!QFileInfo::exists(entry) || !CloneFile(entry, dest))
+    {
+        misses.fetchAndAddRelaxed(1);
+        return false;
+    }
+
+    TouchFile(entry);
+    hits.fetchAndAddRelaxed(1);
+    return true;
+}
+
+//Adds a freshly converted sample file to the cache
+void StoreCachedSample(Hash128 hash, quint8 baseNote, QString variant, QString source)
+{
+    if (!IsSampleCacheEnabled())
+        return;
+
+    QString entry = EntryPath(hash, baseNote, variant);
+    QString temp = entry + "." + QString::number(QCoreApplication::applicationPid()) + "." +
+            QString::number(reinterpret_cast<quintptr>(QThread::currentThreadId()), 16) + ".tmp";
+
+    if (!CloneFile(source, temp))
+        return;
+
+    if (RenameFileOver(temp, entry))
+        stored.fetchAndAddRelaxed(1);
+    else
+        QFile::remove(temp);
+}
+
+//Removes the least recently used entries until the cache fits its size
+void TrimSampleCache()
+{
+    if (!IsSampleCacheEnabled())
+        return;
+
+    QDir dir(cacheDir);
+    QFileInfoList entries = dir.entryInfoList(QDir::Files, QDir::Time | QDir::Reversed);
+    QDateTime staleTime = QDateTime::currentDateTime().addSecs(-SAMPLE_CACHE_STALE_TEMP_SECS);
+    qint64 total = 0;
+
+    for (int i=0; i<entries.size(); i++)
+    {
+        if (entries[i].suffix() == "tmp" && entries[i].lastModified() < staleTime)
+            QFile::remove(entries[i].filePath());
+        else
+            total += entries[i].size();
+    }
+
+    //Oldest first
+    for (int i=0; i<entries.size() && total > cacheMaxSize; i++)
+    {
+        if (entries[i].suffix() == "tmp")
+            continue;
+
+        if (QFile::remove(entries[i].filePath()))
+        {
+            total -= entries[i].size();
+            evicted.fetchAndAddRelaxed(1);
+        }
+    }
+}
+
+void ResetSampleCacheStats()
+{
+    hits.fetchAndStoreRelaxed(0);
+    misses.fetchAndStoreRelaxed(0);
+    stored.fetchAndStoreRelaxed(0);
+    evicted.fetchAndStoreRelaxed(0);
+}
+
+SampleCacheStats GetSampleCacheStats()
+{
+    SampleCacheStats stats;
+
+    stats.hits = hits.loadAcquire();
+    stats.misses = misses.loadAcquire();
+    stats.stored = stored.loadAcquire();
+    stats.evicted = evicted.loadAcquire();
+
+    return stats;
+}
+
+static QString EntryPath(Hash128 hash, quint8 baseNote, QString variant)
+{
+    return cacheDir + "/" +
+            QString("%1%2").arg(hash.high, 16, 16, QChar('0')).arg(hash.low, 16, 16, QChar('0')) +
+            "-c" + QString::number(SAMPLE_CACHE_CONVERTER_VERSION) +
+            "-n" + QString::number(baseNote) + variant;
+}
+
+//Reflink (copy on write) if the filesystem can, else a copy. Never a hardlink:
+//an extracted file edited in place would change the cache entry with it
+static bool CloneFile(QString source, QString dest)
+{
+    QFile::remove(dest);
+
+    if (ReflinkFile(source, dest))
+        return true;
+
+    return QFile::copy(source, dest);
+}
+
+static bool ReflinkFile(QString source, QString dest)
+{
+#if defined(Q_OS_LINUX) && defined(FICLONE)
+    int in = open(QFile::encodeName(source).constData(), O_RDONLY);
+    if (in < 0)
+        return false;
+
+    int out = open(QFile::encodeName(dest).constData(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out < 0)
+    {
+        close(in);
+        return false;
+    }
+
+    bool cloned = ioctl(out, FICLONE, in) == 0;
+    close(in);
+    close(out);
+
+    if (!cloned)
+        QFile::remove(dest);
+    return cloned;
+#else
+    Q_UNUSED(source);
+    Q_UNUSED(dest);
+    return false;
+#endif
+}
+
+//Marks an entry as recently used. Windows only sets file times through a
+//handle opened for writing, ReadWrite doesn't truncate the file
+static void TouchFile(QString path)
+{
+    QFile f(path);
+
+    if (f.open(QIODevice::ReadWrite))
+    {
+        f.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+        f.close();
+    }
+}
@@ -0,0 +1,200 @@
+#include "include/sample_similarity.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMILARITY_SSE2
+#endif
+
+#define MINHASH_EMPTY 0xFFFFFFFF
+
+static quint64 MixShingle(quint64 key);
+static int FindRoot(QVector<int> &parents, int i);
+static int PopCount(quint32 x);
+
+//Compact description of a sample that survives padding, a moved loop point or
+//a few changed bytes: the energy envelope and a one permutation MinHash of its
+//quantized windows. Trailing silence is left out of both
+SampleFingerprint FingerprintPcm(const qint8 *samples, quint32 length)
+{
+    SampleFingerprint fp;
+
+    while (length > 0 && qAbs(int(samples[length - 1])) <= FINGERPRINT_SILENCE)
+        length--;
+
+    fp.length = length;
+
+    for (int b=0; b<FINGERPRINT_ENVELOPE_BINS; b++)
+    {
+        quint32 begin = quint64(length) * b / FINGERPRINT_ENVELOPE_BINS;
+        quint32 end = quint64(length) * (b + 1) / FINGERPRINT_ENVELOPE_BINS;
+        double energy = 0;
+
+        for (quint32 i=begin; i<end; i++)
+            energy += samples[i] * samples[i];
+
+        fp.envelope[b] = end > begin ? float(std::sqrt(energy / (end - begin)) / 128) : 0.0f;
+    }
+
+    //Every window is hashed once, the hash picks its bucket and its value
+    for (int b=0; b<FINGERPRINT_MINHASH_BUCKETS; b++)
+        fp.minHash[b] = MINHASH_EMPTY;
+
+    quint64 key = 0;
+    for (quint32 i=0; i<length; i++)
+    {
+        key = (key << 8) | quint8(samples[i] >> FINGERPRINT_QUANTIZE_SHIFT);
+
+        if (i + 1 < FINGERPRINT_SHINGLE_LENGTH)
+            continue;
+
+        quint64 hash = MixShingle(key & ((Q_UINT64_C(1) << (8 * FINGERPRINT_SHINGLE_LENGTH)) - 1));
+        int bucket = hash % FINGERPRINT_MINHASH_BUCKETS;
+        quint32 value = quint32(hash >> 32);
+
+        if (value < fp.minHash[bucket])
+            fp.minHash[bucket] = value;
+    }
+
+    return fp;
+}
+
+//RMS difference of the envelopes, 0 is the same envelope
+float EnvelopeDistance(const SampleFingerprint &a, const SampleFingerprint &b)
+{
+    float sum;
+
+#ifdef SIMILARITY_SSE2
+    __m128 acc = _mm_setzero_ps();
+
+    for (int i=0; i<FINGERPRINT_ENVELOPE_BINS; i += 4)
+    {
+        __m128 d = _mm_sub_ps(_mm_loadu_ps(a.envelope + i), _mm_loadu_ps(b.envelope + i));
+        acc = _mm_add_ps(acc, _mm_mul_ps(d, d));
+    }
+
+    acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+    acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 0x55));
+    sum = _mm_cvtss_f32(acc);
+#else
+    sum = 0;
+    for (int i=0; i<FINGERPRINT_ENVELOPE_BINS; i++)
+        sum += (a.envelope[i] - b.envelope[i]) * (a.envelope[i] - b.envelope[i]);
+#endif
+
+    return std::sqrt(sum / FINGERPRINT_ENVELOPE_BINS);
+}
+
+//Estimated Jaccard similarity of the windows, buckets empty in both are skipped
+float MinHashSimilarity(const SampleFingerprint &a, const SampleFingerprint &b)
+{
+    int equal = 0;
+    int bothEmpty = 0;
+
+#ifdef SIMILARITY_SSE2
+    __m128i empty = _mm_set1_epi32(int(MINHASH_EMPTY));
+
+    for (int i=0; i<FINGERPRINT_MINHASH_BUCKETS; i += 4)
+    {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a.minHash + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b.minHash + i));
+        __m128i same = _mm_cmpeq_epi32(x, y);
+
+        equal += PopCount(_mm_movemask_ps(_mm_castsi128_ps(same)));
+        bothEmpty += PopCount(_mm_movemask_ps(_mm_castsi128_ps(_mm_and_si128(same, _mm_cmpeq_epi32(x, empty)))));
+    }
+#else
+    for (int i=0; i<FINGERPRINT_MINHASH_BUCKETS; i++)
+    {
+        if (a.minHash[i] == b.minHash[i])
+        {
+            equal++;
+            if (a.minHash[i] == MINHASH_EMPTY)
+                bothEmpty++;
+        }
+    }
+#endif
+
+    if (bothEmpty == FINGERPRINT_MINHASH_BUCKETS)
+        return 1;
+
+    return float(equal - bothEmpty) / (FINGERPRINT_MINHASH_BUCKETS - bothEmpty);
+}
+
+//Groups near-duplicates, result[i] is the lowest index in the group of sample i.
+//Samples are swept in length order so only those of similar length are compared
+QVector<int> ClusterFingerprints(const QVector<SampleFingerprint> &fingerprints)
+{
+    QVector<int> byLength(fingerprints.size());
+    QVector<int> parents(fingerprints.size());
+
+    for (int i=0; i<fingerprints.size(); i++)
+    {
+        byLength[i] = i;
+        parents[i] = i;
+    }
+
+    std::sort(byLength.begin(), byLength.end(), [&fingerprints](int a, int b) {
+        return fingerprints[a].length < fingerprints[b].length;
+    });
+
+    for (int i=0; i<byLength.size(); i++)
+    {
+        const SampleFingerprint &a = fingerprints[byLength[i]];
+
+        for (int j=i+1; j<byLength.size(); j++)
+        {
+            const SampleFingerprint &b = fingerprints[byLength[j]];
+
+            if (a.length < b.length * NEAR_DUPLICATE_MIN_LENGTH_RATIO)
+                break;
+
+            if (EnvelopeDistance(a, b) > NEAR_DUPLICATE_MAX_ENVELOPE_DISTANCE ||
+                    MinHashSimilarity(a, b) < NEAR_DUPLICATE_MIN_SIMILARITY)
+                continue;
+
+            int rootA = FindRoot(parents, byLength[i]);
+            int rootB = FindRoot(parents, byLength[j]);
+
+            //The lowest index is the root, like the first of identical samples
+            if (rootA < rootB)
+                parents[rootB] = rootA;
+            else
+                parents[rootA] = rootB;
+        }
+    }
+
+    for (int i=0; i<parents.size(); i++)
+        parents[i] = FindRoot(parents, i);
+
+    return parents;
+}
+
+//splitmix64 finalizer
+static quint64 MixShingle(quint64 key)
+{
+    key += Q_UINT64_C(0x9E3779B97F4A7C15);
+    key = (key ^ (key >> 30)) * Q_UINT64_C(0xBF58476D1CE4E5B9);
+    key = (key ^ (key >> 27)) * Q_UINT64_C(0x94D049BB133111EB);
+    return key ^ (key >> 31);
+}
+
+static int FindRoot(QVector<int> &parents, int i)
+{
+    while (parents[i] != i)
+    {
+        parents[i] = parents[parents[i]];
+        i = parents[i];
+    }
+    return i;
+}
+
+static int PopCount(quint32 x)
+{
+    int count = 0;
+
+    for (; x; x &= x - 1)
+        count++;
+    return count;
+}
@@ -0,0 +1,532 @@
+#include "include/song_renderer.h"
+#include <QtEndian>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define RENDER_SSE2
+#endif
+
+#define RENDER_TICK_TEMPO 150           //Tempo counter a tick takes, tempo 150 is a tick per frame
+#define RENDER_TAIL_FRAMES 600          //Release after the last track ends, 10 seconds at most
+#define RENDER_ENVELOPE_MAX 255
+#define RENDER_POSITION_ONE (Q_UINT64_C(1) << 32)
+#define RELEASE_ALL_KEYS 0x100
+#define WAV_HEADER_LENGTH 44
+
+enum {ENVELOPE_ATTACK, ENVELOPE_DECAY, ENVELOPE_SUSTAIN, ENVELOPE_RELEASE};
+
+//Sequencer state of a track, the m4a defaults until its commands change them
+struct PlayerTrack {
+    const SequenceTrack *info;
+    quint32 event;                  //Next event to play
+    quint32 loopEvent;              //First event at or after loopTick
+    quint32 tick;
+    quint8 loopsLeft;               //Jumps back to loopTick still to do
+    bool playing;
+    const RenderInstrument *instrument;
+    quint8 vol;
+    qint8 pan;                      //Arguments are stored centered on 0
+    qint8 bend;
+    quint8 bendRange;
+    qint8 tune;
+    qint8 keyShift;
+};
+
+//A playing note
+struct PlayerChannel {
+    int track;
+    const RenderVoice *voice;
+    quint8 midiKey;                 //As the track played it, EOT looks for it
+    quint8 key;                     //The one the voice plays, before KEYSH
+    quint8 velocity;
+    qint16 rhythmPan;
+    quint32 gate;                   //Ticks left, TIEs wait for their EOT
+    bool tie;
+    quint8 phase;                   //ENVELOPE_*
+    quint32 envelope;
+    quint64 pos;                    //Into the PCM, 32.32 fixed point
+};
+
+struct Player {
+    const SongSequence *sequence;
+    const RenderVoiceGroup *voiceGroup;
+    QVector<PlayerTrack> tracks;
+    QVector<PlayerChannel> channels;
+    quint32 tempo;                  //BPM
+    quint32 tempoCounter;
+};
+
+static void InitPlayer(Player &player, const SongSequence &sequence, const RenderVoiceGroup &voiceGroup);
+static bool AdvanceFrame(Player &player);
+static bool PlayTick(Player &player);
+static void PlayEvent(Player &player, int track, const SequenceEvent &event);
+static void StartNote(Player &player, int track, quint8 key, quint8 velocity, quint32 gate);
+static void ReleaseNotes(Player &player, int track, quint16 key);
+static bool UpdateEnvelope(PlayerChannel &channel);
+static bool MixChannel(const Player &player, PlayerChannel &channel, float *left, float *right, int count);
+static void MixRun(const float *pcm, quint64 pos, quint64 step, float gainLeft, float gainRight,
+                   float *left, float *right, int count);
+static void MixReverb(float *left, float *right, int start, int end, int delay, float gain);
+static void PackPcm16(const float *left, const float *right, qint16 *out, int count);
+static QByteArray BuildWav(const QVector<float> &left, const QVector<float> &right, int count);
+static qint64 FrameStart(quint32 frame);
+
+//Plays the song the way the m4a driver does: a frame per VBlank, the tempo
+//counter ticking the tracks and the DirectSound envelopes stepped each frame.
+//Voices are resampled with linear interpolation into float buffers at
+//RENDER_SAMPLE_RATE and written as a 16 bit stereo WAV.
+//The loop is played RENDER_LOOPS times, then the notes are released
+QByteArray RenderSongToWav(const SongSequence &sequence, const RenderVoiceGroup &voiceGroup, quint8 reverb)
+{
+    Player player;
+    QVector<float> left;
+    QVector<float> right;
+    quint32 maxFrames = quint32(RENDER_MAX_SECONDS * RENDER_FRAME_RATE);
+    quint32 tailFrames = 0;
+    quint32 frame = 0;
+    int delay = int(std::ceil(RENDER_SAMPLE_RATE / RENDER_FRAME_RATE));
+    //The driver feeds back the last frames: (L + R) / 2 * level / 128
+    float reverbGain = (reverb & 0x80) ? (reverb & 0x7F) / 256.0f : 0.0f;
+
+    InitPlayer(player, sequence, voiceGroup);
+
+    for (; frame<maxFrames; frame++)
+    {
+        if (!AdvanceFrame(player))
+        {
+            //Song over, whatever still sounds fades out
+            if (tailFrames == 0)
+                for (int i=0; i<player.channels.size(); i++)
+                    player.channels[i].phase = ENVELOPE_RELEASE;
+
+            if (player.channels.isEmpty() || tailFrames++ >= RENDER_TAIL_FRAMES)
+                break;
+        }
+
+        int start = int(FrameStart(frame));
+        int end = int(FrameStart(frame + 1));
+
+        if (end > left.size())
+        {
+            int size = qMax(end, left.size() * 2);
+            left.resize(size);
+            right.resize(size);
+        }
+
+        if (reverbGain > 0)
+            MixReverb(left.data(), right.data(), start, end, delay, reverbGain);
+
+        for (int i=0; i<player.channels.size(); )
+        {
+            PlayerChannel &channel = player.channels[i];
+
+            if (UpdateEnvelope(channel) && MixChannel(player, channel, left.data() + start, right.data() + start, end - start))
+                i++;
+            else
+            {
+                channel = player.channels.last();
+                player.channels.removeLast();
+            }
+        }
+    }
+
+    return BuildWav(left, right, int(FrameStart(frame)));
+}
+
+static void InitPlayer(Player &player, const SongSequence &sequence, const RenderVoiceGroup &voiceGroup)
+{
+    player.sequence = &sequence;
+    player.voiceGroup = &voiceGroup;
+    player.tempo = RENDER_TICK_TEMPO;
+    player.tempoCounter = 0;
+    player.tracks.resize(sequence.tracks.size());
+
+    for (int i=0; i<sequence.tracks.size(); i++)
+    {
+        PlayerTrack &track = player.tracks[i];
+        const SequenceTrack &info = sequence.tracks[i];
+
+        track.info = &info;
+        track.event = info.firstEvent;
+        track.loopEvent = info.firstEvent;
+        while (track.loopEvent < info.firstEvent + info.eventCount && sequence.events[track.loopEvent].tick < info.loopTick)
+            track.loopEvent++;
+
+        track.tick = 0;
+        track.loopsLeft = info.loopTick != M4A_NO_LOOP ? RENDER_LOOPS - 1 : 0;
+        track.playing = true;
+        track.instrument = nullptr;
+        track.vol = 127;
+        track.pan = 0;
+        track.bend = 0;
+        track.bendRange = 2;
+        track.tune = 0;
+        track.keyShift = 0;
+    }
+}
+
+//Ticks due this frame, false once every track has ended
+static bool AdvanceFrame(Player &player)
+{
+    bool playing = false;
+
+    player.tempoCounter += player.tempo;
+    while (player.tempoCounter >= RENDER_TICK_TEMPO)
+    {
+        player.tempoCounter -= RENDER_TICK_TEMPO;
+        playing = PlayTick(player) || playing;
+    }
+
+    for (int i=0; i<player.tracks.size() && !playing; i++)
+        playing = player.tracks[i].playing;
+
+    return playing;
+}
+
+static bool PlayTick(Player &player)
+{
+    const QVector<SequenceEvent> &events = player.sequence->events;
+    bool playing = false;
+
+    for (int i=0; i<player.channels.size(); i++)
+    {
+        PlayerChannel &channel = player.channels[i];
+
+        if (channel.gate > 0 && --channel.gate == 0)
+            channel.phase = ENVELOPE_RELEASE;
+    }
+
+    for (int i=0; i<player.tracks.size(); i++)
+    {
+        PlayerTrack &track = player.tracks[i];
+        quint32 last = track.info->firstEvent + track.info->eventCount;
+
+        if (!track.playing)
+            continue;
+
+        if (track.tick >= track.info->endTick)
+        {
+            //FINE stops whatever the track still plays
+            if (track.loopsLeft == 0)
+            {
+                track.playing = false;
+                ReleaseNotes(player, i, RELEASE_ALL_KEYS);
+                continue;
+            }
+            track.loopsLeft--;
+            track.tick = track.info->loopTick;
+            track.event = track.loopEvent;
+        }
+
+        while (track.event < last && events[track.event].tick <= track.tick)
+            PlayEvent(player, i, events[track.event++]);
+
+        track.tick++;
+        playing = true;
+    }
+
+    return playing;
+}
+
+//LFO, MOD, PRIO, MEMACC and XCMD change nothing here
+static void PlayEvent(Player &player, int track, const SequenceEvent &event)
+{
+    PlayerTrack &state = player.tracks[track];
+
+    switch (event.command)
+    {
+    case M4A_NOTE_FIRST:
+        StartNote(player, track, event.args[0], event.args[1], qMax<quint32>(1, event.args[2]));
+        break;
+    case M4A_TIE:
+        StartNote(player, track, event.args[0], event.args[1], 0);
+        break;
+    case M4A_EOT:
+        ReleaseNotes(player, track, event.args[0]);
+        break;
+    case M4A_VOICE:
+        state.instrument = &player.voiceGroup->instruments[event.args[0] & 0x7F];
+        break;
+    case M4A_VOL:
+        state.vol = event.args[0] & 0x7F;
+        break;
+    case M4A_PAN:
+        state.pan = qint8((event.args[0] & 0x7F) - 64);
+        break;
+    case M4A_BEND:
+        state.bend = qint8((event.args[0] & 0x7F) - 64);
+        break;
+    case M4A_BENDR:
+        state.bendRange = event.args[0];
+        break;
+    case M4A_TUNE:
+        state.tune = qint8((event.args[0] & 0x7F) - 64);
+        break;
+    case M4A_KEYSH:
+        state.keyShift = qint8(event.args[0]);
+        break;
+    case M4A_TEMPO:
+        player.tempo = event.args[0] * 2;
+        break;
+    default:
+        break;
+    }
+}
+
+//A keysplit picks its voice by the note, a rhythm instrument also plays the
+//voice's own key with its pan
+static void StartNote(Player &player, int track, quint8 key, quint8 velocity, quint32 gate)
+{
+    const RenderInstrument *instrument = player.tracks[track].instrument;
+    PlayerChannel channel;
+
+    if (!instrument || instrument->voices.isEmpty())
+        return;
+
+    int index = instrument->split.isEmpty() ? 0 : instrument->split[key & 0x7F];
+    if (index >= instrument->voices.size() || instrument->voices[index].type == RENDER_VOICE_SILENT)
+        return;
+
+    channel.track = track;
+    channel.voice = &instrument->voices[index];
+    channel.midiKey = key;
+    channel.key = instrument->rhythm ? channel.voice->key : key;
+    channel.velocity = velocity & 0x7F;
+    channel.rhythmPan = 0;
+    if (instrument->rhythm && (channel.voice->pan & 0x80))
+        channel.rhythmPan = ((channel.voice->pan & 0x7F) - 64) * 2;
+    channel.gate = gate;
+    channel.tie = gate == 0;
+    channel.phase = ENVELOPE_ATTACK;
+    channel.envelope = 0;
+    channel.pos = 0;
+
+    player.channels.append(channel);
+}
+
+//TIEs of the key, or every note of the track
+static void ReleaseNotes(Player &player, int track, quint16 key)
+{
+    for (int i=0; i<player.channels.size(); i++)
+    {
+        PlayerChannel &channel = player.channels[i];
+
+        if (channel.track == track && (key == RELEASE_ALL_KEYS || (channel.tie && channel.midiKey == key)))
+        {
+            channel.tie = false;
+            channel.phase = ENVELOPE_RELEASE;
+        }
+    }
+}
+
+//One frame of the DirectSound envelope, false once the channel is silent
+static bool UpdateEnvelope(PlayerChannel &channel)
+{
+    const RenderVoice &voice = *channel.voice;
+
+    switch (channel.phase)
+    {
+    case ENVELOPE_ATTACK:
+        channel.envelope += voice.atk;
+        if (channel.envelope >= RENDER_ENVELOPE_MAX)
+        {
+            channel.envelope = RENDER_ENVELOPE_MAX;
+            channel.phase = ENVELOPE_DECAY;
+        }
+        break;
+    case ENVELOPE_DECAY:
+        channel.envelope = (channel.envelope * voice.dec) >> 8;
+        if (channel.envelope <= voice.sus)
+        {
+            channel.envelope = voice.sus;
+            channel.phase = ENVELOPE_SUSTAIN;
+        }
+        break;
+    case ENVELOPE_RELEASE:
+        channel.envelope = (channel.envelope * voice.rel) >> 8;
+        break;
+    default:
+        break;
+    }
+
+    return channel.envelope > 0 || channel.phase == ENVELOPE_ATTACK;
+}
+
+//Mixes a frame of the channel, false once a sample that doesn't loop is over
+static bool MixChannel(const Player &player, PlayerChannel &channel, float *left, float *right, int count)
+{
+    const PlayerTrack &track = player.tracks[channel.track];
+    const RenderVoice &voice = *channel.voice;
+    quint64 end = quint64(voice.length) << 32;
+    quint64 loopStart = quint64(qMax(0, voice.loopStart)) << 32;
+
+    //Volume and pan the way TrkVolPitSet and ChnVolSetAsm work them out
+    int y = 2 * track.pan;
+    int volRight = ((y + 128) * track.vol * 2) >> 8;
+    int volLeft = ((127 - y) * track.vol * 2) >> 8;
+    int chnRight = qMin(255, (channel.velocity * (128 + channel.rhythmPan) * volRight) >> 14);
+    int chnLeft = qMin(255, (channel.velocity * (127 - channel.rhythmPan) * volLeft) >> 14);
+    float gainRight = chnRight * channel.envelope / (256.0f * 256.0f);
+    float gainLeft = chnLeft * channel.envelope / (256.0f * 256.0f);
+
+    double semitones = 0;
+    if (voice.type != RENDER_VOICE_FIXED)
+        semitones = channel.key + track.keyShift - 60 + (track.tune + track.bend * track.bendRange) / 64.0;
+    quint64 step = quint64(voice.rate * std::pow(2.0, semitones / 12) / RENDER_SAMPLE_RATE * RENDER_POSITION_ONE);
+
+    if (step == 0 || voice.length == 0)
+        return false;
+
+    for (int done=0; done<count; )
+    {
+        if (channel.pos >= end)
+        {
+            if (voice.loopStart == RENDER_NO_LOOP || loopStart >= end)
+                return false;
+            channel.pos = loopStart + (channel.pos - end) % (end - loopStart);
+        }
+
+        //Outputs before the position reaches the end of the sample
+        quint64 run = qMin<quint64>((end - channel.pos + step - 1) / step, count - done);
+
+        MixRun(voice.pcm.constData(), channel.pos, step, gainLeft, gainRight, left + done, right + done, int(run));
+        channel.pos += step * run;
+        done += int(run);
+    }
+
+    return true;
+}
+
+//Linear interpolation, four outputs at once. The samples are gathered one by
+//one, the rest of the work is vectorized
+static void MixRun(const float *pcm, quint64 pos, quint64 step, float gainLeft, float gainRight,
+                   float *left, float *right, int count)
+{
+    int i = 0;
+
+#ifdef RENDER_SSE2
+    const __m128 gl = _mm_set1_ps(gainLeft);
+    const __m128 gr = _mm_set1_ps(gainRight);
+    const __m128 fracScale = _mm_set1_ps(1.0f / 65536);
+
+    for (; i+4<=count; i+=4)
+    {
+        quint64 p0 = pos;
+        quint64 p1 = p0 + step;
+        quint64 p2 = p1 + step;
+        quint64 p3 = p2 + step;
+        const float *s0 = pcm + (p0 >> 32);
+        const float *s1 = pcm + (p1 >> 32);
+        const float *s2 = pcm + (p2 >> 32);
+        const float *s3 = pcm + (p3 >> 32);
+        __m128 a = _mm_setr_ps(s0[0], s1[0], s2[0], s3[0]);
+        __m128 b = _mm_setr_ps(s0[1], s1[1], s2[1], s3[1]);
+        __m128i fracs = _mm_setr_epi32(int((p0 >> 16) & 0xFFFF), int((p1 >> 16) & 0xFFFF),
+                                       int((p2 >> 16) & 0xFFFF), int((p3 >> 16) & 0xFFFF));
+        __m128 frac = _mm_mul_ps(_mm_cvtepi32_ps(fracs), fracScale);
+        __m128 value = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), frac));
+
+        _mm_storeu_ps(left + i, _mm_add_ps(_mm_loadu_ps(left + i), _mm_mul_ps(value, gl)));
+        _mm_storeu_ps(right + i, _mm_add_ps(_mm_loadu_ps(right + i), _mm_mul_ps(value, gr)));
+        pos = p3 + step;
+    }
+#endif
+
+    for (; i<count; i++)
+    {
+        const float *s = pcm + (pos >> 32);
+        float frac = ((pos >> 16) & 0xFFFF) / 65536.0f;
+        float value = s[0] + (s[1] - s[0]) * frac;
+
+        left[i] += value * gainLeft;
+        right[i] += value * gainRight;
+        pos += step;
+    }
+}
+
+//Adds the echo of the output delay samples back. The delay is at least a
+//frame long so this only reads frames that are already mixed
+static void MixReverb(float *left, float *right, int start, int end, int delay, float gain)
+{
+    int i = qMax(start, delay);
+
+#ifdef RENDER_SSE2
+    const __m128 g = _mm_set1_ps(gain);
+
+    for (; i+4<=end; i+=4)
+    {
+        __m128 echo = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(left + i - delay), _mm_loadu_ps(right + i - delay)), g);
+
+        _mm_storeu_ps(left + i, _mm_add_ps(_mm_loadu_ps(left + i), echo));
+        _mm_storeu_ps(right + i, _mm_add_ps(_mm_loadu_ps(right + i), echo));
+    }
+#endif
+
+    for (; i<end; i++)
+    {
+        float echo = (left[i - delay] + right[i - delay]) * gain;
+
+        left[i] += echo;
+        right[i] += echo;
+    }
+}
+
+//Interleaved 16 bit PCM, clipped like the driver clips its 8 bit buffer
+static void PackPcm16(const float *left, const float *right, qint16 *out, int count)
+{
+    int i = 0;
+
+#ifdef RENDER_SSE2
+    const __m128 scale = _mm_set1_ps(32767.0f);
+    const __m128 high = _mm_set1_ps(1.0f);
+    const __m128 low = _mm_set1_ps(-1.0f);
+
+    for (; i+4<=count; i+=4)
+    {
+        __m128 l = _mm_max_ps(low, _mm_min_ps(high, _mm_loadu_ps(left + i)));
+        __m128 r = _mm_max_ps(low, _mm_min_ps(high, _mm_loadu_ps(right + i)));
+        __m128i first = _mm_cvtps_epi32(_mm_mul_ps(_mm_unpacklo_ps(l, r), scale));
+        __m128i second = _mm_cvtps_epi32(_mm_mul_ps(_mm_unpackhi_ps(l, r), scale));
+
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * i), _mm_packs_epi32(first, second));
+    }
+#endif
+
+    for (; i<count; i++)
+    {
+        out[2 * i] = qint16(qRound(qBound(-1.0f, left[i], 1.0f) * 32767.0f));
+        out[2 * i + 1] = qint16(qRound(qBound(-1.0f, right[i], 1.0f) * 32767.0f));
+    }
+}
+
+static QByteArray BuildWav(const QVector<float> &left, const QVector<float> &right, int count)
+{
+    QByteArray wav(WAV_HEADER_LENGTH + count * 4, 0);
+    uchar *bytes = reinterpret_cast<uchar*>(wav.data());
+
+    memcpy(bytes, "RIFF", 4);
+    qToLittleEndian<quint32>(wav.size() - 8, bytes + 4);
+    memcpy(bytes + 8, "WAVEfmt ", 8);
+    qToLittleEndian<quint32>(16, bytes + 16);
+    qToLittleEndian<quint16>(1, bytes + 20);                        //PCM
+    qToLittleEndian<quint16>(2, bytes + 22);
+    qToLittleEndian<quint32>(RENDER_SAMPLE_RATE, bytes + 24);
+    qToLittleEndian<quint32>(RENDER_SAMPLE_RATE * 4, bytes + 28);
+    qToLittleEndian<quint16>(4, bytes + 32);
+    qToLittleEndian<quint16>(16, bytes + 34);
+    memcpy(bytes + 36, "data", 4);
+    qToLittleEndian<quint32>(count * 4, bytes + 40);
+
+    //Written in host order, every target this builds for is little-endian
+    if (count > 0)
+        PackPcm16(left.constData(), right.constData(), reinterpret_cast<qint16*>(bytes + WAV_HEADER_LENGTH), count);
+
+    return wav;
+}
+
+//First output sample of a frame
+static qint64 FrameStart(quint32 frame)
+{
+    return qint64(frame * (RENDER_SAMPLE_RATE / RENDER_FRAME_RATE));
+}